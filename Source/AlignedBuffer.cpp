@@ -0,0 +1,67 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "AlignedBuffer.h"
+
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#else
+#include <malloc.h>
+#endif
+
+void* AlignedMemory::allocate(size_t bytes)
+{
+    if (bytes == 0)
+        return nullptr;
+
+    const size_t alignment = bytes >= HUGE_PAGE ? HUGE_PAGE : CACHE_LINE;
+    bytes = (bytes + alignment - 1) & ~(alignment - 1);
+
+#ifdef _WIN32
+    return _aligned_malloc(bytes, alignment);
+#else
+    void* memory = nullptr;
+
+    if (posix_memalign(&memory, alignment, bytes) != 0)
+        return nullptr;
+
+#ifdef MADV_HUGEPAGE
+    // Fewer TLB misses when the data thread walks through a large staging buffer
+    if (alignment == HUGE_PAGE)
+        madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+
+    return memory;
+#endif
+}
+
+void AlignedMemory::release(void* memory)
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
@@ -0,0 +1,86 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef ALIGNEDBUFFER_H_INCLUDED
+#define ALIGNEDBUFFER_H_INCLUDED
+
+#include <cstddef>
+
+/** Raw allocations aligned to a cache line, or to a huge page for large ones */
+namespace AlignedMemory
+{
+    const size_t CACHE_LINE = 64;
+    const size_t HUGE_PAGE = size_t(2) << 20;
+
+    /** Allocates at least bytes bytes, or returns nullptr. Blocks of a huge page or more are
+        aligned on one and, on Linux, marked as eligible for transparent huge pages. */
+    void* allocate(size_t bytes);
+
+    /** Frees memory returned by allocate() */
+    void release(void* memory);
+}
+
+/**
+    Fixed-capacity array of trivially copyable values in aligned memory.
+
+    Unlike std::vector, it never reallocates behind the caller's back:
+    the capacity only changes in allocate(), which discards the contents.
+*/
+template <typename T>
+class AlignedBuffer
+{
+public:
+
+    AlignedBuffer() = default;
+
+    ~AlignedBuffer() { AlignedMemory::release(values); }
+
+    /** Replaces the buffer by one of count values; returns false if the memory could not be allocated */
+    bool allocate(size_t count)
+    {
+        AlignedMemory::release(values);
+
+        values = static_cast<T*>(AlignedMemory::allocate(count * sizeof(T)));
+        capacity = values != nullptr ? count : 0;
+
+        return values != nullptr || count == 0;
+    }
+
+    T* data() { return values; }
+    const T* data() const { return values; }
+
+    size_t size() const { return capacity; }
+
+    T& operator[](size_t index) { return values[index]; }
+    const T& operator[](size_t index) const { return values[index]; }
+
+private:
+
+    T* values = nullptr;
+    size_t capacity = 0;
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+};
+
+#endif  // ALIGNEDBUFFER_H_INCLUDED
@@ -0,0 +1,131 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "ClockSync.h"
+
+#include <algorithm>
+#include <cmath>
+
+ClockSync::ClockSync()
+    : sender(WINDOW), local(WINDOW), residuals(WINDOW), scratch(WINDOW), lowerHalf(WINDOW), all(WINDOW, true)
+{
+}
+
+void ClockSync::reset()
+{
+    count = 0;
+    next = 0;
+    offset = 0.0;
+    slope = 1.0;
+    driftPpm = 0.0f;
+    jitterMicroseconds = 0.0f;
+}
+
+void ClockSync::addPair(double senderSeconds, double localSeconds)
+{
+    if (count == 0)
+    {
+        senderOrigin = senderSeconds;
+        localOrigin = localSeconds;
+    }
+
+    sender[next] = senderSeconds - senderOrigin;
+    local[next] = localSeconds - localOrigin;
+    next = (next + 1) % WINDOW;
+    count = std::min(count + 1, WINDOW);
+
+    if (count < 2)
+    {
+        offset = local[0] - sender[0];
+        slope = 1.0;
+        return;
+    }
+
+    fit(all);
+
+    for (int i = 0; i < count; i++)
+        residuals[i] = local[i] - (offset + slope * sender[i]);
+
+    // Keep the least delayed half and fit again
+    std::copy(residuals.begin(), residuals.begin() + count, scratch.begin());
+    std::nth_element(scratch.begin(), scratch.begin() + count / 2, scratch.begin() + count);
+    const double median = scratch[count / 2];
+
+    for (int i = 0; i < count; i++)
+        lowerHalf[i] = residuals[i] <= median;
+
+    fit(lowerHalf);
+
+    // Spread of the delays around the final fit
+    for (int i = 0; i < count; i++)
+        residuals[i] = local[i] - (offset + slope * sender[i]);
+
+    std::copy(residuals.begin(), residuals.begin() + count, scratch.begin());
+    std::nth_element(scratch.begin(), scratch.begin() + count / 2, scratch.begin() + count);
+    const double centre = scratch[count / 2];
+
+    for (int i = 0; i < count; i++)
+        scratch[i] = std::fabs(residuals[i] - centre);
+
+    std::nth_element(scratch.begin(), scratch.begin() + count / 2, scratch.begin() + count);
+
+    driftPpm = float((slope - 1.0) * 1.0e6);
+    jitterMicroseconds = float(1.4826 * scratch[count / 2] * 1.0e6);
+}
+
+void ClockSync::fit(const std::vector<bool>& use)
+{
+    double n = 0.0, sx = 0.0, sy = 0.0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (use[i])
+        {
+            n += 1.0;
+            sx += sender[i];
+            sy += local[i];
+        }
+    }
+
+    const double mx = sx / n;
+    const double my = sy / n;
+    double sxx = 0.0, sxy = 0.0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (use[i])
+        {
+            sxx += (sender[i] - mx) * (sender[i] - mx);
+            sxy += (sender[i] - mx) * (local[i] - my);
+        }
+    }
+
+    // All pairs at the same sender time: only the offset can be estimated
+    slope = sxx > 0.0 ? sxy / sxx : 1.0;
+    offset = my - slope * mx;
+}
+
+double ClockSync::toLocal(double senderSeconds) const
+{
+    return localOrigin + offset + slope * (senderSeconds - senderOrigin);
+}
@@ -0,0 +1,95 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef CLOCKSYNC_H_INCLUDED
+#define CLOCKSYNC_H_INCLUDED
+
+#include <atomic>
+#include <vector>
+
+/**
+    Maps the clock of a remote sender to the local clock, from pairs of
+    (timestamp in a packet, local time at which it was received).
+
+    The pairs of a sliding window are fitted with local = offset + slope * sender.
+    Transit delays only ever add to the local time, so after a first least-squares
+    fit only the pairs at or below the median residual (the least delayed half)
+    are fitted again; queueing bursts and scheduling hiccups do not bias the result.
+    The fit is updated with every pair and never allocates after the constructor.
+    The drift and jitter can be read from another thread.
+*/
+class ClockSync
+{
+public:
+
+    /** Number of pairs in the sliding window */
+    static const int WINDOW = 256;
+
+    /** Pairs needed before toLocal() gives an estimate */
+    static const int MIN_PAIRS = 8;
+
+    /** Constructor */
+    ClockSync();
+
+    /** Forgets all pairs, e.g. when acquisition restarts */
+    void reset();
+
+    /** Adds a pair, in seconds, and updates the fit */
+    void addPair(double senderSeconds, double localSeconds);
+
+    /** True once enough pairs have been added */
+    bool isValid() const { return count >= MIN_PAIRS; }
+
+    /** Local time of a sender time, in seconds */
+    double toLocal(double senderSeconds) const;
+
+    /** Rate difference of the sender clock relative to the local one, in parts per million */
+    float getDriftPpm() const { return driftPpm; }
+
+    /** Robust spread (1.4826 x median absolute deviation) of the residuals of the fit, in microseconds */
+    float getJitterMicroseconds() const { return jitterMicroseconds; }
+
+private:
+
+    /** Least-squares fit of the pairs whose index is flagged in use */
+    void fit(const std::vector<bool>& use);
+
+    std::vector<double> sender;     // Relative to the first pair, to keep the precision of the fit
+    std::vector<double> local;
+    std::vector<double> residuals;
+    std::vector<double> scratch;
+    std::vector<bool> lowerHalf;
+    std::vector<bool> all;
+
+    int count = 0;
+    int next = 0;
+    double senderOrigin = 0.0;
+    double localOrigin = 0.0;
+    double offset = 0.0;
+    double slope = 1.0;
+
+    std::atomic<float> driftPpm { 0.0f };
+    std::atomic<float> jitterMicroseconds { 0.0f };
+};
+
+#endif  // CLOCKSYNC_H_INCLUDED
@@ -0,0 +1,246 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "Decimator.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    const double PI = 3.14159265358979323846;
+
+    /** Dot product of n values, n a multiple of 8; the eight partial sums let the compiler vectorize it */
+    inline float dot(const float* a, const float* b, int n)
+    {
+        float acc[8] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+        for (int k = 0; k < n; k += 8)
+        {
+            for (int j = 0; j < 8; j++)
+                acc[j] += a[k + j] * b[k + j];
+        }
+
+        return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+    }
+}
+
+void Decimator::reset(int newFactor, int nChannels, int maxSamples)
+{
+    factor = newFactor < 1 ? 1 : newFactor;
+    numChannels = nChannels;
+    nextSampleNumber = -1;
+
+    const int numTaps = TAPS_PER_FACTOR * factor + 1;
+    const int paddedTaps = (numTaps + 7) / 8 * 8;
+
+    // Windowed sinc, cut off at 0.4 / factor cycles per input sample, with unity gain at DC
+    const double cutoff = 0.4 / factor;
+    const double centre = 0.5 * (numTaps - 1);
+
+    std::vector<double> h(numTaps);
+    double sum = 0.0;
+
+    for (int n = 0; n < numTaps; n++)
+    {
+        const double t = n - centre;
+        const double sinc = t == 0.0 ? 2.0 * cutoff : std::sin(2.0 * PI * cutoff * t) / (PI * t);
+        const double window = 0.42 - 0.5 * std::cos(2.0 * PI * n / (numTaps - 1))
+                              + 0.08 * std::cos(4.0 * PI * n / (numTaps - 1));
+
+        h[n] = sinc * window;
+        sum += h[n];
+    }
+
+    // Reversed, so that an output is the dot product with the input in time order;
+    // the leading zeros only pad the length to a multiple of 8
+    taps.assign(paddedTaps, 0.0f);
+
+    for (int n = 0; n < numTaps; n++)
+        taps[paddedTaps - 1 - n] = float(h[n] / sum);
+
+    historySize = paddedTaps - 1;
+    workStride = historySize + maxSamples;
+    work.assign(size_t(numChannels) * workStride, 0.0f);
+
+    codeWork.assign(size_t(getDelay()) + maxSamples / factor + 1, 0);
+    events.clear();
+    events.reserve(256);
+    firstEvent = 0;
+}
+
+int Decimator::getFirstKeptIndex(int64_t firstSampleNumber) const
+{
+    const int remainder = int(((firstSampleNumber % factor) + factor) % factor);
+
+    return (factor - remainder) % factor;
+}
+
+namespace
+{
+    /** Outputs of a block numbered before the start of the stream, which are dropped */
+    inline int getSkippedOutputs(int64_t firstOutput, int numOutputs)
+    {
+        return firstOutput >= 0 ? 0 : int(-firstOutput < numOutputs ? -firstOutput : numOutputs);
+    }
+}
+
+int Decimator::getNumOutputSamples(int64_t firstSampleNumber, int nSamples) const
+{
+    const int numOutputs = getOutputIndex(firstSampleNumber, nSamples);
+    const int64_t firstOutput = (firstSampleNumber + getFirstKeptIndex(firstSampleNumber)) / factor - getDelay();
+
+    return numOutputs - getSkippedOutputs(firstOutput, numOutputs);
+}
+
+int64_t Decimator::getOutputSampleNumber(int64_t firstSampleNumber) const
+{
+    const int64_t firstOutput = (firstSampleNumber + getFirstKeptIndex(firstSampleNumber)) / factor - getDelay();
+
+    return firstOutput < 0 ? 0 : firstOutput;
+}
+
+int64_t Decimator::getLastOutputAge(int64_t firstSampleNumber, int nSamples) const
+{
+    const int64_t lastOutput = getOutputSampleNumber(firstSampleNumber) + getNumOutputSamples(firstSampleNumber, nSamples) - 1;
+
+    return firstSampleNumber + nSamples - 1 - lastOutput * factor;
+}
+
+int Decimator::getOutputIndex(int64_t firstSampleNumber, int inputIndex) const
+{
+    const int firstKept = getFirstKeptIndex(firstSampleNumber);
+
+    return inputIndex <= firstKept ? 0 : (inputIndex - firstKept + factor - 1) / factor;
+}
+
+int Decimator::process(const float* const* channels, int nSamples, int64_t firstSampleNumber, float* dst, int dstStride)
+{
+    if (factor == 1)
+    {
+        for (int ch = 0; ch < numChannels; ch++)
+            memcpy(dst + size_t(ch) * dstStride, channels[ch], nSamples * sizeof(float));
+
+        return nSamples;
+    }
+
+    // Only a block larger than any seen before allocates
+    if (historySize + nSamples > workStride)
+    {
+        const int newStride = historySize + nSamples;
+        std::vector<float> grown(size_t(numChannels) * newStride);
+
+        for (int ch = 0; ch < numChannels; ch++)
+            memcpy(grown.data() + size_t(ch) * newStride, work.data() + size_t(ch) * workStride, historySize * sizeof(float));
+
+        work.swap(grown);
+        workStride = newStride;
+    }
+
+    if (firstSampleNumber != nextSampleNumber)
+    {
+        std::fill(work.begin(), work.end(), 0.0f);
+        std::fill(codeWork.begin(), codeWork.end(), uint16_t(0));
+    }
+
+    nextSampleNumber = firstSampleNumber + nSamples;
+
+    const int firstKept = getFirstKeptIndex(firstSampleNumber);
+    const int numKept = getOutputIndex(firstSampleNumber, nSamples);
+    const int numOutputs = getNumOutputSamples(firstSampleNumber, nSamples);
+    const int skipped = numKept - numOutputs;
+    const int paddedTaps = historySize + 1;
+
+    for (int ch = 0; ch < numChannels; ch++)
+    {
+        float* x = work.data() + size_t(ch) * workStride;
+        float* y = dst + size_t(ch) * dstStride;
+
+        memcpy(x + historySize, channels[ch], nSamples * sizeof(float));
+
+        // Output j ends at input sample firstKept + j * factor, i.e. at x[historySize + firstKept + j * factor]
+        for (int j = skipped; j < numKept; j++)
+            y[j - skipped] = dot(taps.data(), x + firstKept + j * factor, paddedTaps);
+
+        memmove(x, x + nSamples, historySize * sizeof(float));
+    }
+
+    return numOutputs;
+}
+
+int Decimator::processCodes(uint16_t* codes, int nSamples, int64_t firstSampleNumber)
+{
+    if (factor == 1)
+        return nSamples;
+
+    const int delay = getDelay();
+    const int firstKept = getFirstKeptIndex(firstSampleNumber);
+    const int numKept = getOutputIndex(firstSampleNumber, nSamples);
+    const int numOutputs = getNumOutputSamples(firstSampleNumber, nSamples);
+
+    // Only a block larger than any seen before allocates
+    if (codeWork.size() < size_t(delay + numKept))
+        codeWork.resize(size_t(delay + numKept));
+
+    // The codes of the last `delay` kept samples precede those of this block
+    for (int j = 0; j < numKept; j++)
+        codeWork[delay + j] = codes[firstKept + j * factor];
+
+    for (int j = 0; j < numOutputs; j++)
+        codes[j] = codeWork[numKept - numOutputs + j];
+
+    memmove(codeWork.data(), codeWork.data() + numKept, delay * sizeof(uint16_t));
+
+    return numOutputs;
+}
+
+void Decimator::addEvent(int64_t sampleNumber, int line, bool state)
+{
+    // Drop the taken changes rather than grow past the reserved size
+    if (events.size() == events.capacity() && firstEvent > 0)
+    {
+        events.erase(events.begin(), events.begin() + firstEvent);
+        firstEvent = 0;
+    }
+
+    // The next kept sample shows the change; its output is numbered like that input sample
+    const int64_t outputSample = sampleNumber <= 0 ? 0 : (sampleNumber + factor - 1) / factor;
+
+    events.push_back({ outputSample, line, state });
+}
+
+bool Decimator::takeEvent(int64_t endSampleNumber, Event& event)
+{
+    if (firstEvent == events.size() || events[firstEvent].sampleNumber >= endSampleNumber)
+        return false;
+
+    event = events[firstEvent++];
+
+    if (firstEvent == events.size())
+    {
+        events.clear();
+        firstEvent = 0;
+    }
+
+    return true;
+}
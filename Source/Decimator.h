@@ -0,0 +1,125 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef DECIMATOR_H_INCLUDED
+#define DECIMATOR_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+    Anti-aliasing decimation of a multichannel stream by an integer factor.
+
+    A linear-phase low-pass FIR (Blackman-windowed sinc, TAPS_PER_FACTOR * factor + 1
+    taps, cut off at 80% of the output Nyquist frequency) runs on every channel, and
+    only the outputs that are kept are computed, which is the polyphase form of the
+    decimating filter: each output costs one dot product of the taps with the input.
+
+    The kept samples are those whose sample number is a multiple of the factor. The
+    filter delays the signal by getDelay() = TAPS_PER_FACTOR / 2 output samples, so the
+    output computed at input sample n * factor is numbered n - getDelay(): an output
+    sample number times the factor is the input sample it shows, whatever the block
+    sizes. The first getDelay() outputs of a stream would be numbered before its start
+    and are not returned. TTL codes and changes go through the same delay, so that
+    they stay aligned with the samples. The filter state carries over from one block
+    to the next and is cleared when the sample numbers are not contiguous (e.g. a new
+    acquisition).
+*/
+class Decimator
+{
+public:
+
+    /** Filter length, in taps per unit of decimation factor */
+    static const int TAPS_PER_FACTOR = 16;
+
+    /** Designs the filter and clears the state; a factor of 1 passes the samples through.
+        Blocks of up to maxSamples are processed without allocating. */
+    void reset(int factor, int nChannels, int maxSamples);
+
+    int getFactor() const { return factor; }
+
+    /** Output samples by which the filter delays the signal */
+    int getDelay() const { return factor > 1 ? TAPS_PER_FACTOR / 2 : 0; }
+
+    /** A TTL change, at an output sample number */
+    struct Event
+    {
+        int64_t sampleNumber;
+        int line;
+        bool state;
+    };
+
+    /** Index of the first kept sample of a block starting at firstSampleNumber */
+    int getFirstKeptIndex(int64_t firstSampleNumber) const;
+
+    /** Number of samples process() returns for a block */
+    int getNumOutputSamples(int64_t firstSampleNumber, int nSamples) const;
+
+    /** Output sample number of the first sample process() returns for a block */
+    int64_t getOutputSampleNumber(int64_t firstSampleNumber) const;
+
+    /**
+        Input samples from the one shown by the last sample process() returns for a block
+        to the last input sample of the block (only meaningful for a block with outputs)
+    */
+    int64_t getLastOutputAge(int64_t firstSampleNumber, int nSamples) const;
+
+    /** Maps a sample index of the input block to the index of the next kept sample in the output block */
+    int getOutputIndex(int64_t firstSampleNumber, int inputIndex) const;
+
+    /**
+        Filters a block of nSamples per channel, starting at sample number firstSampleNumber,
+        and writes the kept samples of channel ch to dst + ch * dstStride. Returns their number.
+    */
+    int process(const float* const* channels, int nSamples, int64_t firstSampleNumber, float* dst, int dstStride);
+
+    /**
+        Replaces the per-sample TTL codes of a block, after process() has been called for it,
+        by the codes of its outputs, delayed like the samples. Returns their number.
+    */
+    int processCodes(uint16_t* codes, int nSamples, int64_t firstSampleNumber);
+
+    /** Queues a TTL change at an input sample number, for the output sample that shows that input sample */
+    void addEvent(int64_t sampleNumber, int line, bool state);
+
+    /** Takes the oldest queued change numbered before endSampleNumber; false if there is none */
+    bool takeEvent(int64_t endSampleNumber, Event& event);
+
+private:
+
+    int factor = 1;
+    int numChannels = 0;
+    int historySize = 0;                // numTaps - 1 past samples kept per channel
+    int64_t nextSampleNumber = -1;
+
+    std::vector<float> taps;            // time-reversed, zero-padded to a multiple of 8
+    std::vector<float> work;            // per channel: history followed by the current block
+    int workStride = 0;
+
+    std::vector<uint16_t> codeWork;     // delayed codes followed by the kept codes of the current block
+    std::vector<Event> events;          // queued changes, taken from firstEvent on
+    size_t firstEvent = 0;
+};
+
+#endif  // DECIMATOR_H_INCLUDED
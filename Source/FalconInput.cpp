@@ -29,6 +29,38 @@
 
 #include "FalconInput.h"
 #include "FalconInputEditor.h"
+#include "ZmqTransport.h"
+
+#include <algorithm>
+#include <limits>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+/** CPU time used by the calling thread, in seconds */
+static double getThreadCpuSeconds()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+
+    return double(k.QuadPart + u.QuadPart) * 1.0e-7;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    return double(now.tv_sec) + double(now.tv_nsec) * 1.0e-9;
+#endif
+}
 
 
 DataThread* FalconInput::createDataThread(SourceNode *sn)
@@ -46,6 +78,9 @@ FalconInput::FalconInput(SourceNode* sn) : DataThread(sn),
 {
     sourceBuffers.add(new DataBuffer(num_channels, MAX_NUM_SAMPLES)); // start with 16 channels and automatically resize
 
+    sources.add(new FalconSource());
+    sources[0]->buffer = sourceBuffers[0];
+
     tryToConnect();
 
     zmq_msg_init(&message);
@@ -82,48 +117,84 @@ void FalconInput::updateSettings(OwnedArray<ContinuousChannel>* continuousChanne
     configurationObjects->clear();
     sourceStreams->clear();
 
-    sourceBuffers[0]->resize(num_channels, MAX_NUM_SAMPLES);
+    // Size everything after the publishers instead of the values typed in the editor:
+    // every stream found becomes a DataStream of its own. Discovery blocks for up to
+    // DISCOVERY_TIMEOUT_MS, so other signal chain updates reuse the streams already found
+    if (auto_configure && connected && discovery_pending)
+    {
+        discoverStreams();
+        discovery_pending = false;
+    }
 
-    DataStream::Settings settings
+    // By hand, or until a packet has been received, a single stream takes every packet
+    if (!auto_configure || sources.isEmpty())
     {
-        "FalconInputStream",
-        "Data streamed from a Falcon Output plugin",
-        "falconinput.source",
+        const int max_block_samples = sources.isEmpty() ? 0 : sources[0]->max_block_samples;
+
+        sources.clear();
 
-        sample_rate
+        FalconSource* source = new FalconSource();
+        source->num_channels = num_channels;
+        source->sample_rate = sample_rate;
+        source->max_block_samples = max_block_samples;
+        sources.add(source);
+    }
 
-    };
+    while (sourceBuffers.size() < sources.size())
+        sourceBuffers.add(new DataBuffer(DEFAULT_NUM_CHANNELS, MAX_NUM_SAMPLES));
 
-    sourceStreams->add(new DataStream(settings));
-    sourceBuffers[0]->resize(num_channels, 10000);
+    while (sourceBuffers.size() > sources.size())
+        sourceBuffers.removeLast();
 
-    for (int ch = 0; ch < num_channels; ch++)
+    for (int index = 0; index < sources.size(); index++)
     {
+        FalconSource* source = sources[index];
 
-        ContinuousChannel::Settings settings{
-            ContinuousChannel::Type::ELECTRODE,
-            "CH" + String(ch + 1),
-            "Continuous data streamed from a Falcon Output plugin",
-            "falconinput.source.channel",
+        source->buffer = sourceBuffers[index];
+        source->buffer->resize(source->num_channels, MAX_NUM_SAMPLES);
+        resizeStaging(*source, source->max_block_samples);
 
-            0.195,
+        DataStream::Settings settings
+        {
+            source->name.isNotEmpty() ? source->name : "FalconInputStream",
+            "Data streamed from a Falcon Output plugin",
+            "falconinput.source",
+
+            source->sample_rate
 
-            sourceStreams->getFirst()
         };
 
-        continuousChannels->add(new ContinuousChannel(settings));
-    }
+        DataStream* stream = new DataStream(settings);
+        sourceStreams->add(stream);
+
+        for (int ch = 0; ch < source->num_channels; ch++)
+        {
+
+            ContinuousChannel::Settings settings{
+                ContinuousChannel::Type::ELECTRODE,
+                "CH" + String(ch + 1),
+                "Continuous data streamed from a Falcon Output plugin",
+                "falconinput.source.channel",
+
+                ch < int(source->bit_volts.size()) ? source->bit_volts[ch] : 0.195f,
+
+                stream
+            };
 
-    EventChannel::Settings eventSettings{
-           EventChannel::Type::TTL,
-           "Events",
-           "Event data streamed from a Falcon Output plugin",
-           "falconinput.source.events",
-           sourceStreams->getFirst(),
-           16
-    };
+            continuousChannels->add(new ContinuousChannel(settings));
+        }
+
+        EventChannel::Settings eventSettings{
+               EventChannel::Type::TTL,
+               "Events",
+               "Event data streamed from a Falcon Output plugin",
+               "falconinput.source.events",
+               stream,
+               NUM_TTL_LINES
+        };
 
-    eventChannels->add(new EventChannel(eventSettings));
+        eventChannels->add(new EventChannel(eventSettings));
+    }
 
 }
 
@@ -134,7 +205,29 @@ bool FalconInput::foundInputSource()
 
 bool FalconInput::startAcquisition()
 {
-    total_samples = 0;
+    packet_latency.reset();
+    decode_latency.reset();
+
+    for (auto source : sources)
+    {
+        source->total_samples = 0;
+        resizeStaging(*source, source->max_block_samples);
+
+        source->expected_message_id = -1;
+        source->expected_sample_num = -1;
+        source->last_event_code = 0;
+        source->received_name = String();
+        source->clock.reset();
+    }
+
+    ignored_streams.clear();
+
+    lost_packets = 0;
+    lost_samples = 0;
+
+    cpu_window_start = 0;
+    receive_cpu = 0.0f;
+    last_packet_ticks = 0;
 
     startThread();
 
@@ -143,6 +236,8 @@ bool FalconInput::startAcquisition()
 
 void FalconInput::closeConnection()
 {
+    shared_memory.close();
+
     if (socket)
     {
         LOGD("Closing data socket");
@@ -152,7 +247,9 @@ void FalconInput::closeConnection()
 
     if (context)
     {
-        zmq_ctx_destroy(context);
+        if (context != ZmqTransport::getSharedContext())
+            zmq_ctx_destroy(context);
+
         context = nullptr;
     }
 }
@@ -161,18 +258,62 @@ void  FalconInput::tryToConnect()
 {
 
     closeConnection();
+    discovery_pending = true;
+
+    if (transport == ZmqTransport::SHARED_MEMORY)
+    {
+        // Like a ZMQ connect, this succeeds before the writer exists: read() maps the segment once it appears
+        std::string segment = SharedMemoryRing::getSegmentName(port);
+
+        if (shared_memory.open(segment))
+            LOGC("Falcon Input mapped shared memory ", segment);
+        else
+            LOGC("Falcon Input waiting for shared memory ", segment);
+
+        connected = true;
+        return;
+    }
 
-    // Create your ZMQ socket
-    context = zmq_ctx_new();
-    auto tcp_address = "tcp://" + address + ":" + std::to_string(port);
+    // Create your ZMQ socket (inproc endpoints are only visible within the shared context)
+    context = transport == ZmqTransport::INPROC ? ZmqTransport::getSharedContext() : ZmqTransport::createContext(socket_options);
+    String endpoint = ZmqTransport::getConnectEndpoint(ZmqTransport::Type(transport), address.toStdString(),
+                                                       port, ipc_path.toStdString());
     socket = zmq_socket(context, ZMQ_SUB);
-    zmq_setsockopt(socket, ZMQ_SUBSCRIBE, nullptr, 0);
-    int rc = zmq_connect(socket, tcp_address.toStdString().c_str());
+    receive_timeout = -1;
+
+    // Conflation keeps the last frame of a multipart message alone, so it only works with a
+    // single-stream publisher: a stream name, several endpoints or several streams mean topic frames
+    ZmqTransport::SocketOptions options = socket_options;
+
+    if (options.conflate && (stream_name.isNotEmpty() || endpoints.isNotEmpty() || sources.size() > 1))
+    {
+        LOGC("Falcon Input ignores conflate with a stream name, further endpoints or a multi-stream publisher");
+        options.conflate = false;
+    }
+
+    ZmqTransport::applySocketOptions(socket, options, false);
+
+    // A single-stream publisher sends no topic frame, so a topic filter would be matched against
+    // the packet itself: subscribe to everything and check the stream field, as with shared memory
+    zmq_setsockopt(socket, ZMQ_SUBSCRIBE, "", 0);
+    int rc = zmq_connect(socket, endpoint.toRawUTF8());
 
     if (rc == 0)
     {
-        LOGC("Falcon Input connected to ", tcp_address);
+        LOGC("Falcon Input connected to ", endpoint);
         connected = true;
+
+        // The socket fair-queues the packets of every publisher it is connected to
+        for (auto extra : StringArray::fromTokens(endpoints, ", ", ""))
+        {
+            if (extra.isEmpty())
+                continue;
+
+            if (zmq_connect(socket, extra.toRawUTF8()) == 0)
+                LOGC("Falcon Input connected to ", extra);
+            else
+                LOGC("Falcon Input couldn't connect to ", extra, ": ", zmq_strerror(zmq_errno()));
+        }
     }
     else
     {
@@ -191,77 +332,468 @@ bool FalconInput::stopAcquisition()
 
     waitForThreadToExit(500);
 
-    sourceBuffers[0]->clear();
+    if (lost_packets > 0 || lost_samples > 0)
+        LOGC("Falcon Input lost ", lost_packets.load(), " packets (", lost_samples.load(), " samples) during acquisition");
+
+    if (save_latency_csv)
+        writeLatencyCsv();
+
+    for (auto buffer : sourceBuffers)
+        buffer->clear();
+
     return true;
 }
 
+const openephysflatbuffer::ContinuousData* FalconInput::receivePacket(int timeout_ms)
+{
+    if (transport == ZmqTransport::SHARED_MEMORY)
+    {
+        size_t size;
+        const uint8_t* frame = shared_memory.read(size, timeout_ms);
+
+        if (frame == nullptr)
+            return nullptr;
+
+        flatbuffers::Verifier verifier(frame, size);
+
+        if (!openephysflatbuffer::VerifyContinuousDataBuffer(verifier))
+            return nullptr;
+
+        return acceptStream(openephysflatbuffer::GetContinuousData(frame));
+    }
+
+    if (socket == nullptr)
+        return nullptr;
+
+    int flags = ZMQ_DONTWAIT;
+
+    if (timeout_ms > 0 && receive_mode == RECEIVE_BLOCKING)
+    {
+        // Let ZMQ block in zmq_msg_recv, without a separate poll call
+        if (receive_timeout != timeout_ms)
+        {
+            zmq_setsockopt(socket, ZMQ_RCVTIMEO, &timeout_ms, sizeof(timeout_ms));
+            receive_timeout = timeout_ms;
+        }
+
+        flags = 0;
+    }
+    else if (timeout_ms > 0)
+    {
+        zmq_pollitem_t item = { socket, 0, ZMQ_POLLIN, 0 };
+
+        if (zmq_poll(&item, 1, timeout_ms) <= 0)
+            return nullptr;
+    }
+
+    if (zmq_msg_recv(&message, socket, flags) == -1)
+        return nullptr;
+
+    // Multi-stream publishers send the stream name as a topic frame before each packet
+    if (zmq_msg_more(&message))
+    {
+        std::string topic((const char*)zmq_msg_data(&message), zmq_msg_size(&message));
+
+        if (zmq_msg_recv(&message, socket, 0) == -1)
+            return nullptr;
+
+        // Spikes and messages forwarded by the output are not continuous data
+        if (topic == ZmqTransport::SPIKE_TOPIC || topic == ZmqTransport::MESSAGE_TOPIC)
+            return nullptr;
+    }
+
+    // Any endpoint can send anything: check every offset before the decoder follows it
+    const uint8_t* frame = static_cast<const uint8_t*>(zmq_msg_data(&message));
+    flatbuffers::Verifier verifier(frame, zmq_msg_size(&message));
+
+    if (!openephysflatbuffer::VerifyContinuousDataBuffer(verifier))
+        return nullptr;
+
+    return acceptStream(openephysflatbuffer::GetContinuousData(frame));
+}
+
+const openephysflatbuffer::ContinuousData* FalconInput::acceptStream(const openephysflatbuffer::ContinuousData* data) const
+{
+    if (stream_name.isNotEmpty() && (data->stream() == nullptr || stream_name != data->stream()->c_str()))
+        return nullptr;
+
+    return data;
+}
+
 bool FalconInput::updateBuffer()
 {
-   
-    const openephysflatbuffer::ContinuousData* data;
+    const openephysflatbuffer::ContinuousData* data = nullptr;
+
+    switch (receive_mode)
+    {
+        case RECEIVE_SPIN:
+            data = receivePacket(0);
+            break;
+
+        case RECEIVE_ADAPTIVE:
+            // Packets come in bursts: keep spinning shortly after one, then sleep until the next
+            data = receivePacket(0);
+
+            if (data == nullptr
+                && Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - last_packet_ticks) * 1.0e6 > ADAPTIVE_SPIN_US)
+                data = receivePacket(RECEIVE_TIMEOUT_MS);
+
+            break;
+
+        default:
+            data = receivePacket(RECEIVE_TIMEOUT_MS);
+            break;
+    }
+
+    // Drain whatever else is already queued, so that a burst is caught up in one call
+    for (int packets = 0; data != nullptr; )
+    {
+        last_packet_ticks = Time::getHighResolutionTicks();
+
+        addPacket(data);
+
+        if (++packets == RECEIVE_BATCH_PACKETS)
+            break;
+
+        data = receivePacket(0);
+    }
+
+    for (auto source : sources)
+        flushPackets(*source);
+
+    updateCpuUsage();
+
+    return true;
+}
+
+void FalconInput::updateCpuUsage()
+{
+    const int64 now = Time::getHighResolutionTicks();
+
+    if (cpu_window_start == 0)
+    {
+        cpu_window_start = now;
+        cpu_window_seconds = getThreadCpuSeconds();
+        return;
+    }
+
+    const double elapsed = Time::highResolutionTicksToSeconds(now - cpu_window_start);
+
+    if (elapsed < 0.5)
+        return;
+
+    const double cpu = getThreadCpuSeconds();
+
+    receive_cpu = float((cpu - cpu_window_seconds) / elapsed * 100.0);
+    cpu_window_start = now;
+    cpu_window_seconds = cpu;
+}
+
+bool FalconInput::discoverStreams()
+{
+    OwnedArray<FalconSource> found;
+    int known_packets = 0;
+    const uint32 deadline = Time::getMillisecondCounter() + DISCOVERY_TIMEOUT_MS;
 
-    if (zmq_msg_recv(&message, socket, ZMQ_DONTWAIT) != -1)  // Non-blocking to wait to receive a message
+    // Listen until the streams stop changing: every publisher has had a chance to send by then
+    for (uint32 now = Time::getMillisecondCounter(); now < deadline && known_packets < DISCOVERY_QUIET_PACKETS;
+         now = Time::getMillisecondCounter())
     {
+        const openephysflatbuffer::ContinuousData* data = receivePacket(int(deadline - now));
+
+        if (data == nullptr || data->n_channels() == 0)
+            continue;
 
-        try {
-            data = openephysflatbuffer::GetContinuousData(zmq_msg_data(&message));
+        const String name = data->stream() != nullptr ? String(data->stream()->c_str()) : String();
+        FalconSource* source = nullptr;
+
+        for (auto candidate : found)
+        {
+            if (candidate->name == name)
+                source = candidate;
         }
-        catch (...) {
-            std::cout << "Impossible to parse the packet received - skipping to the next." << std::endl;
-            return true;
+
+        if (source != nullptr)
+        {
+            source->max_block_samples = jmax(source->max_block_samples, int(data->n_samples()));
+            known_packets++;
+            continue;
         }
 
-       // std::cout << "Received packet number: " << data->message_id()
-       //     << ", Stream: " << data->stream()->c_str()
-       //      << ", Sample_Number: " << data->sample_num()
-       //     << ", Samples: " << data->n_samples()
-        //    << ", Channels: " << data->n_channels() << std::endl;
+        source = new FalconSource();
+        source->name = name;
+        source->num_channels = int(data->n_channels());
+        source->sample_rate = data->sample_rate() > 0 ? float(data->sample_rate()) : sample_rate;
+        source->max_block_samples = int(data->n_samples());
+
+        if (data->bit_volts() != nullptr)
+            source->bit_volts.assign(data->bit_volts()->begin(), data->bit_volts()->end());
+
+        LOGC("Falcon Input found stream ", name, ": ", source->num_channels, " channels at ", source->sample_rate, " Hz");
+
+        found.add(source);
+        known_packets = 0;
+
+        // Only one stream can match a subscription to a stream name
+        if (stream_name.isNotEmpty())
+            break;
+    }
+
+    if (found.isEmpty())
+    {
+        LOGC("Falcon Input did not receive any packet to configure itself; keeping ", num_channels, " channels at ", sample_rate, " Hz");
+        return false;
+    }
+
+    sources.swapWith(found);
+
+    // The editor shows the first stream
+    num_channels = sources[0]->num_channels;
+    sample_rate = sources[0]->sample_rate;
+
+    return true;
+}
 
-        double sent_timestamp = data->timestamp();
-        double received_timestamp = double(Time::getHighResolutionTicks()) / double(Time::getHighResolutionTicksPerSecond());
+FalconSource* FalconInput::findSource(const openephysflatbuffer::ContinuousData* data)
+{
+    const char* name = data->stream() != nullptr ? data->stream()->c_str() : "";
 
-        //std::cout << "Packet delay " << data->message_id() << ": " << received_timestamp - sent_timestamp << std::endl;
+    if (sources.size() == 1 && sources[0]->name.isEmpty())
+    {
+        // A stream configured by hand takes unnamed packets and a single stream: mixing streams
+        // would break its channel count and its sample sequence
+        FalconSource* source = sources[0];
 
-        const int num_samples = data->n_samples();
+        if (*name == 0 || source->received_name == name)
+            return source;
 
-        const flatbuffers::Vector<float>* d = data->samples();
-        const flatbuffers::Vector<uint16>* e = data->event_codes(); 
-        int offset = 0;
-        
-        for (int ch = 0; ch < num_channels; ch++)
+        if (source->received_name.isEmpty())
+        {
+            source->received_name = name;
+            LOGC("Falcon Input receiving stream ", source->received_name);
+            return source;
+        }
+    }
+    else
+    {
+        for (auto source : sources)
         {
+            if (source->name == name)
+                return source;
+        }
+    }
+
+    if (!ignored_streams.contains(name))
+    {
+        ignored_streams.add(name);
+        LOGC("Falcon Input ignoring the packets of stream ", String(name),
+             ": set its name or use auto-configure to receive it");
+    }
+
+    return nullptr;
+}
+
+void FalconInput::addPacket(const openephysflatbuffer::ContinuousData* data)
+{
+    const int64 decode_start = Time::getHighResolutionTicks();
+
+   // std::cout << "Received packet number: " << data->message_id()
+   //     << ", Stream: " << data->stream()->c_str()
+   //      << ", Sample_Number: " << data->sample_num()
+   //     << ", Samples: " << data->n_samples()
+    //    << ", Channels: " << data->n_channels() << std::endl;
+
+    // The sender stamps packets with the same monotonic clock, so this only holds on one host
+    double sent_timestamp = data->timestamp();
+    double received_timestamp = Time::highResolutionTicksToSeconds(decode_start);
+
+    if (sent_timestamp > 0)
+        packet_latency.record((received_timestamp - sent_timestamp) * 1.0e6);
+
+    const int num_samples = data->n_samples();
+
+    if (num_samples > MAX_NUM_SAMPLES)
+    {
+        LOGD("Falcon Input: skipping packet ", data->message_id(), " with ", num_samples, " samples");
+        return;
+    }
+
+    // Streams that appeared after the last signal chain update are ignored until the next one
+    FalconSource* source = findSource(data);
+
+    if (source == nullptr)
+        return;
+
+    if (sent_timestamp > 0)
+        source->clock.addPair(sent_timestamp, received_timestamp);
+
+    checkSequence(*source, data);
+
+    if (source->staged_samples + num_samples > source->staging_capacity)
+        flushPackets(*source);
+
+    // Only a block larger than any seen before reallocates; the next acquisition starts at that size
+    if (num_samples > source->staging_capacity)
+    {
+        LOGC("Falcon Input: growing the staging buffers for blocks of ", num_samples, " samples");
+        resizeStaging(*source, num_samples);
+
+        if (num_samples > source->staging_capacity)
+            return;
+    }
+
+    source->max_block_samples = jmax(source->max_block_samples, num_samples);
+
+    const int staged = source->staged_samples;
 
-            int zero_values = 0;
-
-            for (int i = 0; i < num_samples; i++)
-            {
-                if (offset < d->size())
-                {
-                    samples[num_channels * i + ch] = d->Get(offset);
-                }
-                else {
-                    samples[num_channels * i + ch] = 0;
-                }
-                
-                offset++;
-
-                if (ch == 0)
-                {
-                    event_codes[i] = uint64(e->Get(i));
-                    sample_numbers[i] = total_samples + i;
-                    timestamp_s[i] = -1;
-  
-                }
-
-            }
+    if (decoder.decode(data, source->samples.data() + size_t(staged) * source->num_channels, source->num_channels) == 0)
+        LOGD("Falcon Input: couldn't decode the samples of packet ", data->message_id());
 
+    // Either keep the sender's numbering (with holes where packets were lost) or number the samples contiguously
+    if (gap_policy == GAP_SENDER_NUMBERS)
+        source->total_samples = int64(data->sample_num());
+
+    // Per-sample codes or sparse TTL changes, as the state of the 64 lines at every sample
+    // (juce::uint64 and uint64_t are distinct types of the same width on some platforms)
+    decoder.decodeEvents(data, reinterpret_cast<uint64_t*>(source->event_codes.data() + staged));
+
+    for (int i = 0; i < num_samples; i++)
+        source->sample_numbers[staged + i] = source->total_samples + i;
+
+    // The sender stamps a block once its last input sample has been acquired; with decimation,
+    // the last sample sent is last_sample_age older than that
+    if (sent_timestamp > 0 && source->clock.isValid())
+    {
+        const double last = source->clock.toLocal(sent_timestamp) - data->last_sample_age();
+        const double period = 1.0 / source->sample_rate;
+
+        for (int i = 0; i < num_samples; i++)
+            source->timestamp_s[staged + i] = last - (num_samples - 1 - i) * period;
+    }
+    else
+    {
+        for (int i = 0; i < num_samples; i++)
+            source->timestamp_s[staged + i] = -1;
+    }
+
+    if (num_samples > 0)
+        source->last_event_code = source->event_codes[staged + num_samples - 1];
+
+    source->staged_samples += num_samples;
+    source->total_samples += num_samples;
+
+    decode_latency.record(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - decode_start) * 1.0e6);
+}
+
+void FalconInput::checkSequence(FalconSource& source, const openephysflatbuffer::ContinuousData* data)
+{
+    const int64 message_id = int64(data->message_id());
+    const int64 sample_num = int64(data->sample_num());
+
+    if (source.expected_message_id >= 0)
+    {
+        if (message_id > source.expected_message_id)
+            lost_packets += message_id - source.expected_message_id;
+
+        const int64 gap = sample_num - source.expected_sample_num;
+
+        if (gap < 0 || gap > int64(source.sample_rate * MAX_GAP_FILL_SECONDS))
+        {
+            // The sender restarted, or skipped too far ahead to pad: pick up from here
+            LOGD("Falcon Input: resynchronizing from sample ", source.expected_sample_num, " to ", sample_num);
+        }
+        else if (gap > 0)
+        {
+            lost_samples += gap;
+
+            if (gap_policy == GAP_FILL_ZEROS)
+                fillGap(source, int(gap), 0.0f);
+            else if (gap_policy == GAP_FILL_NAN)
+                fillGap(source, int(gap), std::numeric_limits<float>::quiet_NaN());
+        }
+    }
+
+    source.expected_message_id = message_id + 1;
+    source.expected_sample_num = sample_num + int64(data->n_samples());
+}
+
+void FalconInput::fillGap(FalconSource& source, int num_samples, float value)
+{
+    if (source.staging_capacity == 0)
+        return;
+
+    while (num_samples > 0)
+    {
+        if (source.staged_samples == source.staging_capacity)
+            flushPackets(source);
+
+        const int staged = source.staged_samples;
+        const int count = jmin(num_samples, source.staging_capacity - staged);
+
+        std::fill(source.samples.data() + size_t(staged) * source.num_channels,
+                  source.samples.data() + size_t(staged + count) * source.num_channels, value);
+
+        // Keep the TTL lines where they were, so that the gap does not create events
+        for (int i = 0; i < count; i++)
+        {
+            source.event_codes[staged + i] = source.last_event_code;
+            source.sample_numbers[staged + i] = source.total_samples + i;
+            source.timestamp_s[staged + i] = -1;
         }
 
-        sourceBuffers[0]->addToBuffer(samples, sample_numbers, timestamp_s, event_codes, num_samples);
+        source.staged_samples += count;
+        source.total_samples += count;
+        num_samples -= count;
+    }
+}
 
-        total_samples += num_samples;
+void FalconInput::flushPackets(FalconSource& source)
+{
+    if (source.staged_samples == 0)
+        return;
+
+    source.buffer->addToBuffer(source.samples.data(), source.sample_numbers.data(), source.timestamp_s.data(),
+                               source.event_codes.data(), source.staged_samples);
+
+    source.staged_samples = 0;
+}
+
+void FalconInput::resizeStaging(FalconSource& source, int block_samples)
+{
+    const int capacity = jlimit(1, MAX_NUM_SAMPLES, (block_samples > 0 ? block_samples : DEFAULT_BLOCK_SAMPLES) * STAGING_BLOCKS);
+
+    source.staged_samples = 0;
+
+    if (capacity <= source.staging_capacity && source.num_channels == source.staging_channels)
+        return;
+
+    if (!source.samples.allocate(size_t(capacity) * source.num_channels)
+        || !source.timestamp_s.allocate(capacity)
+        || !source.event_codes.allocate(capacity)
+        || !source.sample_numbers.allocate(capacity))
+    {
+        LOGE("Falcon Input: couldn't allocate the staging buffers for ", source.num_channels, " channels");
+        source.staging_capacity = 0;
+        source.staging_channels = 0;
+        return;
     }
 
-    return true;
+    source.staging_capacity = capacity;
+    source.staging_channels = source.num_channels;
+}
+
+void FalconInput::writeLatencyCsv()
+{
+    File file = CoreServices::getRecordingParentDirectory()
+                    .getChildFile("falcon_input_latency_" + Time::getCurrentTime().formatted("%Y-%m-%d_%H-%M-%S") + ".csv");
+
+    String csv(LatencyHistogram::getCsvHeader());
+    csv += packet_latency.getCsvRows("one_way");
+    csv += decode_latency.getCsvRows("decode");
+
+    if (file.replaceWithText(csv))
+        LOGC("Falcon Input latency histograms written to ", file.getFullPathName());
+    else
+        LOGE("Couldn't write ", file.getFullPathName());
 }
 
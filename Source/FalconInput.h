@@ -27,16 +27,63 @@
 
 #include <DataThreadHeaders.h>
 
+#include "AlignedBuffer.h"
+#include "ClockSync.h"
+#include "PacketCodec.h"
+#include "SharedMemoryRing.h"
+#include "LatencyHistogram.h"
+#include "ZmqTransport.h"
+
 #include <zmq.h>
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <vector>
 
 const int DEFAULT_PORT = 3335;
 const String DEFAULT_ADDRESS = "127.0.0.1";
+const String DEFAULT_IPC_PATH = "/tmp/falcon-output";
 const float DEFAULT_SAMPLE_RATE = 40000.0f;
 const int DEFAULT_NUM_CHANNELS = 16;
-const int MAX_NUM_SAMPLES = 10000;
-#define MAX_NUM_CHANNELS 384
+const int MAX_NUM_SAMPLES = 10000;     // Largest packet accepted, and size of the data buffer
+const int DEFAULT_BLOCK_SAMPLES = 1024; // Block size assumed until a packet has been seen
+const int STAGING_BLOCKS = 4;           // Blocks of the largest size staged before a flush
+const int NUM_TTL_LINES = 64;
+const int DISCOVERY_TIMEOUT_MS = 500;
+const int DISCOVERY_QUIET_PACKETS = 16; // Discovery ends after this many packets without a new stream
+const int RECEIVE_TIMEOUT_MS = 5;       // Longest wait for a packet before updateBuffer() returns
+const int ADAPTIVE_SPIN_US = 500;       // Busy-polling window after each packet in adaptive mode
+const int RECEIVE_BATCH_PACKETS = 64;   // Most queued packets drained by one updateBuffer() call
+const float MAX_GAP_FILL_SECONDS = 10.0f;   // Longer sample_num jumps are treated as a sender restart
+
+/** Receiving state of one stream of the publishers, which has its own DataStream and data buffer */
+struct FalconSource
+{
+    String name;                    // Stream field of its packets; empty takes unnamed packets and a single stream
+    String received_name;           // Without a name: the first stream received, the only one taken afterwards
+    float sample_rate = DEFAULT_SAMPLE_RATE;
+    int num_channels = DEFAULT_NUM_CHANNELS;
+    std::vector<float> bit_volts;   // From the packets; empty when configured by hand
+    DataBuffer* buffer = nullptr;
+
+    int64 total_samples = 0;
+    int staged_samples = 0;     // Samples decoded into the arrays below but not yet in the data buffer
+    int staging_capacity = 0;   // Samples the arrays below can hold
+    int staging_channels = 0;   // Channels per sample in the arrays below
+    int max_block_samples = 0;  // Largest packet received so far
+
+    int64 expected_message_id = -1;
+    int64 expected_sample_num = -1;
+    uint64 last_event_code = 0;
+
+    ClockSync clock;            // Sender timestamps to local time, for the sample timestamps
+
+    // Staged packets, sized by FalconInput::resizeStaging() from the channel count and the largest block
+    AlignedBuffer<float> samples;
+    AlignedBuffer<double> timestamp_s;
+    AlignedBuffer<uint64> event_codes;
+    AlignedBuffer<int64> sample_numbers;
+};
 
 /** 
 * 
@@ -48,6 +95,24 @@ class FalconInput : public DataThread
 
 public:
 
+    /** How the data thread waits for packets */
+    enum ReceiveMode
+    {
+        RECEIVE_SPIN = 0,   // non-blocking receive in a loop: lowest latency, one full core
+        RECEIVE_POLL,       // zmq_poll (or a futex wait for shm) with a RECEIVE_TIMEOUT_MS timeout
+        RECEIVE_BLOCKING,   // blocking zmq_msg_recv with ZMQ_RCVTIMEO
+        RECEIVE_ADAPTIVE    // spin for ADAPTIVE_SPIN_US after each packet, then poll
+    };
+
+    /** What to do with the samples of lost packets, detected from message_id and sample_num */
+    enum GapPolicy
+    {
+        GAP_FILL_ZEROS = 0,     // insert zeros, so that the following samples stay aligned
+        GAP_FILL_NAN,           // insert NaNs
+        GAP_SENDER_NUMBERS,     // insert nothing, but keep the sender's sample numbers
+        GAP_IGNORE              // number the received samples contiguously
+    };
+
     /** Constructor */
     FalconInput(SourceNode* sn);
 
@@ -69,11 +134,42 @@ public:
     String address = DEFAULT_ADDRESS;
     float sample_rate = DEFAULT_SAMPLE_RATE;
     int num_channels = DEFAULT_NUM_CHANNELS;
+    String stream_name;     // Topic to subscribe to when the publisher sends several streams
+    String endpoints;       // Further publishers received by the same socket, comma separated ZMQ endpoints
+    int transport = 0;      // ZmqTransport::Type
+    String ipc_path = DEFAULT_IPC_PATH;
+    bool save_latency_csv = false;  // Write the latency histograms to a CSV file when acquisition stops
+    bool auto_configure = false;    // Take the channel count, sample rate and stream name from the first packet
+    int receive_mode = RECEIVE_POLL;
+    int gap_policy = GAP_FILL_ZEROS;
+    ZmqTransport::SocketOptions socket_options;     // Advanced settings of the subscriber socket
 
 
     void tryToConnect();
     void closeConnection();
 
+    /** Makes the next signal chain update listen to the publishers again (auto-configure) */
+    void refreshStreams() { discovery_pending = true; }
+
+    /** Time from the packet's timestamp to its reception */
+    const LatencyHistogram& getPacketLatency() const { return packet_latency; }
+
+    /** Time spent decoding each packet into the data buffer */
+    const LatencyHistogram& getDecodeLatency() const { return decode_latency; }
+
+    /** CPU usage of the data thread over the last half second, in percent of one core */
+    float getReceiveCpu() const { return receive_cpu; }
+
+    /** Packets and samples missing from the stream since acquisition started */
+    int64 getLostPackets() const { return lost_packets; }
+    int64 getLostSamples() const { return lost_samples; }
+
+    /** Estimated drift of the first publisher's clock relative to the local one, in ppm */
+    float getClockDriftPpm() const { return sources.isEmpty() ? 0.0f : sources.getFirst()->clock.getDriftPpm(); }
+
+    /** Jitter of the packet arrival times around the clock estimate of the first publisher, in microseconds */
+    float getClockJitter() const { return sources.isEmpty() ? 0.0f : sources.getFirst()->clock.getJitterMicroseconds(); }
+
     std::unique_ptr<GenericEditor> createEditor(SourceNode* sn);
     static DataThread* createDataThread(SourceNode* sn);
 
@@ -82,24 +178,71 @@ private:
     /** Moves data from ZMQ message to Open Ephys data buffer*/
     bool updateBuffer() override;
 
+    /** Returns the next packet for the selected stream, waiting up to timeout_ms; valid until the next call */
+    const openephysflatbuffer::ContinuousData* receivePacket(int timeout_ms);
+
+    /** Returns data if it belongs to the stream set in the editor (or if none is set), nullptr otherwise */
+    const openephysflatbuffer::ContinuousData* acceptStream(const openephysflatbuffer::ContinuousData* data) const;
+
+    /** Creates a source for every stream name received, with its channel count and sample rate; false if no packet arrives in time */
+    bool discoverStreams();
+
+    /** Source of a packet, or nullptr if its stream was not discovered (logged once per stream name) */
+    FalconSource* findSource(const openephysflatbuffer::ContinuousData* data);
+
+    /** Measures the CPU time of the data thread (called from updateBuffer()) */
+    void updateCpuUsage();
+
+    /** Decodes a received packet after the ones already staged */
+    void addPacket(const openephysflatbuffer::ContinuousData* data);
+
+    /** Counts the packets and samples lost before this packet, and fills the gap according to gap_policy */
+    void checkSequence(FalconSource& source, const openephysflatbuffer::ContinuousData* data);
+
+    /** Stages num_samples samples of value on every channel of a source */
+    void fillGap(FalconSource& source, int num_samples, float value);
+
+    /** Hands the staged packets of a source to its data buffer in one call */
+    void flushPackets(FalconSource& source);
+
+    /** Sizes the staging arrays of a source for STAGING_BLOCKS blocks of block_samples; drops staged samples */
+    void resizeStaging(FalconSource& source, int block_samples);
+
+    /** Writes the latency histograms next to the recordings */
+    void writeLatencyCsv();
+
     /** Starts data thread */
     bool startAcquisition() override;
 
     /** Stops data thread*/
     bool stopAcquisition()  override;
 
-    int64 total_samples;
+    OwnedArray<FalconSource> sources;   // One per DataStream, in the order of sourceBuffers
+
+    std::atomic<int64> lost_packets { 0 };
+    std::atomic<int64> lost_samples { 0 };
+    StringArray ignored_streams;        // Stream names without a source, already logged
 
     bool connected = false;
+    bool discovery_pending = true;  // The streams found are kept until a new connection or refreshStreams()
 
     void* socket;
     void* context;
     zmq_msg_t message;
 
-    float samples[MAX_NUM_SAMPLES * MAX_NUM_CHANNELS];
-    double timestamp_s[MAX_NUM_SAMPLES];
-    uint64 event_codes[MAX_NUM_SAMPLES];
-    int64 sample_numbers[MAX_NUM_SAMPLES];
+    SharedMemoryRing shared_memory;
+
+    LatencyHistogram packet_latency;
+    LatencyHistogram decode_latency;
+
+    int receive_timeout = -1;   // ZMQ_RCVTIMEO currently set on the socket
+    int64 last_packet_ticks = 0;
+    int64 cpu_window_start = 0;
+    double cpu_window_seconds = 0.0;
+    std::atomic<float> receive_cpu { 0.0f };
+
+    PacketDecoder decoder;
+
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(FalconInput);
 };
@@ -24,6 +24,8 @@
 
 #include "FalconInputEditor.h"
 #include "FalconInput.h"
+#include "SocketOptionsPanel.h"
+#include "ZmqTransport.h"
 
 #include <string>
 #include <iostream>
@@ -32,7 +34,7 @@ FalconInputEditor::FalconInputEditor(GenericProcessor* parentNode, FalconInput *
 {
     node = socket;
 
-    desiredWidth = 240;
+    desiredWidth = 775;
 
     // Address
     addressLabel = new Label("IP Address", "IP Address");
@@ -64,6 +66,13 @@ FalconInputEditor::FalconInputEditor(GenericProcessor* parentNode, FalconInput *
     portInput->setBounds(15, 95, 65, 20);
     addAndMakeVisible(portInput);
 
+    refreshButton = new UtilityButton("scan", Font("Small Text", 10, Font::plain));
+    refreshButton->setBounds(83, 95, 30, 20);
+    refreshButton->setEnabled(node->auto_configure);
+    refreshButton->setTooltip("Listen to the publishers again and rebuild the data streams from what they send (auto-configure)");
+    refreshButton->addListener(this);
+    addAndMakeVisible(refreshButton);
+
     // Num chans
     channelCountLabel = new Label("CHANNELS", "Channels");
     channelCountLabel->setFont(Font("Small Text", 12, Font::plain));
@@ -79,6 +88,13 @@ FalconInputEditor::FalconInputEditor(GenericProcessor* parentNode, FalconInput *
     channelCountInput->addListener(this);
     addAndMakeVisible(channelCountInput);
 
+    autoConfigureButton = new ToggleButton("");
+    autoConfigureButton->setBounds(172, 50, 20, 20);
+    autoConfigureButton->setToggleState(node->auto_configure, dontSendNotification);
+    autoConfigureButton->setTooltip("Auto-configure: take the channel count, sample rate and stream name from the first packet received");
+    autoConfigureButton->addListener(this);
+    addAndMakeVisible(autoConfigureButton);
+
     // Fs
     sampleRateLabel = new Label("FREQ (HZ)", "Sample Rate (Hz)");
     sampleRateLabel->setFont(Font("Small Text", 12, Font::plain));
@@ -94,6 +110,210 @@ FalconInputEditor::FalconInputEditor(GenericProcessor* parentNode, FalconInput *
     sampleRateInput->addListener(this);
     addAndMakeVisible(sampleRateInput);
 
+    // Stream
+    streamLabel = new Label("STREAM", "Stream");
+    streamLabel->setFont(Font("Small Text", 12, Font::plain));
+    streamLabel->setBounds(195, 35, 65, 12);
+    streamLabel->setColour(Label::textColourId, Colours::darkgrey);
+    addAndMakeVisible(streamLabel);
+
+    streamInput = new Label("Stream", node->stream_name);
+    streamInput->setFont(Font("Small Text", 12, Font::plain));
+    streamInput->setBounds(200, 50, 95, 20);
+    streamInput->setEditable(true);
+    streamInput->setColour(Label::backgroundColourId, Colours::lightgrey);
+    streamInput->setTooltip("Name of the stream to receive from a multi-stream Falcon Output (empty for all)");
+    streamInput->addListener(this);
+    addAndMakeVisible(streamInput);
+
+    // Transport
+    transportLabel = new Label("TRANSPORT", "Transport");
+    transportLabel->setFont(Font("Small Text", 12, Font::plain));
+    transportLabel->setBounds(195, 80, 65, 12);
+    transportLabel->setColour(Label::textColourId, Colours::darkgrey);
+    addAndMakeVisible(transportLabel);
+
+    transportSelector = new ComboBox("Transport");
+    transportSelector->addItem("tcp", ZmqTransport::TCP + 1);
+    transportSelector->addItem("ipc", ZmqTransport::IPC + 1);
+    transportSelector->addItem("inproc", ZmqTransport::INPROC + 1);
+#ifndef _WIN32
+    transportSelector->addItem("shm", ZmqTransport::SHARED_MEMORY + 1);
+#endif
+    transportSelector->setSelectedId(node->transport + 1, dontSendNotification);
+    transportSelector->setBounds(200, 95, 95, 20);
+    transportSelector->setTooltip("tcp for remote hosts, ipc or shm (shared memory) for the same host, inproc for the same process");
+    transportSelector->addListener(this);
+    addAndMakeVisible(transportSelector);
+
+    updateAddressField();
+
+    // Latency
+    latencyLabel = new Label("LATENCY", "Latency p50/p99/p99.9/max (us)");
+    latencyLabel->setFont(Font("Small Text", 12, Font::plain));
+    latencyLabel->setBounds(305, 35, 160, 12);
+    latencyLabel->setColour(Label::textColourId, Colours::darkgrey);
+    addAndMakeVisible(latencyLabel);
+
+    latencyStatus = new Label("Latency", "");
+    latencyStatus->setFont(Font("Small Text", 10, Font::plain));
+    latencyStatus->setBounds(305, 50, 160, 30);
+    latencyStatus->setJustificationType(Justification::topLeft);
+    latencyStatus->setColour(Label::textColourId, Colours::darkgrey);
+    latencyStatus->setTooltip("One-way: from the packet timestamp to its reception (same host only). Decode: packet to data buffer");
+    addAndMakeVisible(latencyStatus);
+
+    latencyCsvButton = new ToggleButton("Save latency CSV");
+    latencyCsvButton->setBounds(305, 95, 140, 20);
+    latencyCsvButton->setToggleState(node->save_latency_csv, dontSendNotification);
+    latencyCsvButton->setTooltip("Write the latency histograms to a CSV file in the recording directory when acquisition stops");
+    latencyCsvButton->addListener(this);
+    addAndMakeVisible(latencyCsvButton);
+
+    // Receive mode
+    receiveLabel = new Label("RECEIVE", "Receive");
+    receiveLabel->setFont(Font("Small Text", 12, Font::plain));
+    receiveLabel->setBounds(465, 35, 65, 12);
+    receiveLabel->setColour(Label::textColourId, Colours::darkgrey);
+    addAndMakeVisible(receiveLabel);
+
+    receiveSelector = new ComboBox("Receive");
+    receiveSelector->addItem("spin", FalconInput::RECEIVE_SPIN + 1);
+    receiveSelector->addItem("poll", FalconInput::RECEIVE_POLL + 1);
+    receiveSelector->addItem("blocking", FalconInput::RECEIVE_BLOCKING + 1);
+    receiveSelector->addItem("adaptive", FalconInput::RECEIVE_ADAPTIVE + 1);
+    receiveSelector->setSelectedId(node->receive_mode + 1, dontSendNotification);
+    receiveSelector->setBounds(470, 50, 90, 20);
+    receiveSelector->setTooltip("How the data thread waits for packets: spin uses a full core for the lowest latency, "
+                                "poll and blocking sleep until a packet arrives, adaptive spins briefly after each packet");
+    receiveSelector->addListener(this);
+    addAndMakeVisible(receiveSelector);
+
+    receiveStatus = new Label("Receive CPU", "");
+    receiveStatus->setFont(Font("Small Text", 10, Font::plain));
+    receiveStatus->setBounds(465, 75, 100, 15);
+    receiveStatus->setColour(Label::textColourId, Colours::darkgrey);
+    receiveStatus->setTooltip("CPU usage of the data thread, in percent of one core");
+    addAndMakeVisible(receiveStatus);
+
+    socketButton = new UtilityButton("socket", Font("Small Text", 12, Font::plain));
+    socketButton->setBounds(470, 95, 70, 20);
+    socketButton->setTooltip("Advanced ZeroMQ settings: high water mark, buffers, I/O threads, affinity, conflate, keepalive");
+    socketButton->addListener(this);
+    addAndMakeVisible(socketButton);
+
+    // Lost packets
+    gapLabel = new Label("GAPS", "Lost packets");
+    gapLabel->setFont(Font("Small Text", 12, Font::plain));
+    gapLabel->setBounds(565, 35, 100, 12);
+    gapLabel->setColour(Label::textColourId, Colours::darkgrey);
+    addAndMakeVisible(gapLabel);
+
+    gapSelector = new ComboBox("Gaps");
+    gapSelector->addItem("fill zeros", FalconInput::GAP_FILL_ZEROS + 1);
+    gapSelector->addItem("fill NaN", FalconInput::GAP_FILL_NAN + 1);
+    gapSelector->addItem("sender numbers", FalconInput::GAP_SENDER_NUMBERS + 1);
+    gapSelector->addItem("ignore", FalconInput::GAP_IGNORE + 1);
+    gapSelector->setSelectedId(node->gap_policy + 1, dontSendNotification);
+    gapSelector->setBounds(570, 50, 90, 20);
+    gapSelector->setTooltip("Fill the samples of lost packets with zeros or NaN to keep the timeline aligned, "
+                            "keep the sender's sample numbers, or ignore the gaps");
+    gapSelector->addListener(this);
+    addAndMakeVisible(gapSelector);
+
+    gapStatus = new Label("Lost", "");
+    gapStatus->setFont(Font("Small Text", 10, Font::plain));
+    gapStatus->setBounds(565, 75, 100, 30);
+    gapStatus->setJustificationType(Justification::topLeft);
+    gapStatus->setColour(Label::textColourId, Colours::darkgrey);
+    gapStatus->setTooltip("Packets and samples missing from the stream, from the message_id and sample_num of each packet");
+    addAndMakeVisible(gapStatus);
+
+    // Further publishers
+    endpointsLabel = new Label("SOURCES", "More sources");
+    endpointsLabel->setFont(Font("Small Text", 12, Font::plain));
+    endpointsLabel->setBounds(665, 35, 100, 12);
+    endpointsLabel->setColour(Label::textColourId, Colours::darkgrey);
+    addAndMakeVisible(endpointsLabel);
+
+    endpointsInput = new Label("Sources", node->endpoints);
+    endpointsInput->setFont(Font("Small Text", 12, Font::plain));
+    endpointsInput->setBounds(670, 50, 95, 20);
+    endpointsInput->setEditable(true);
+    endpointsInput->setColour(Label::backgroundColourId, Colours::lightgrey);
+    endpointsInput->setTooltip("Further Falcon Outputs to receive from, as comma separated endpoints (e.g. tcp://10.0.0.2:3335). "
+                               "With auto-configure, every stream received becomes a data stream of its own");
+    endpointsInput->addListener(this);
+    addAndMakeVisible(endpointsInput);
+
+    clockStatus = new Label("Clock", "");
+    clockStatus->setFont(Font("Small Text", 10, Font::plain));
+    clockStatus->setBounds(665, 75, 100, 30);
+    clockStatus->setJustificationType(Justification::topLeft);
+    clockStatus->setColour(Label::textColourId, Colours::darkgrey);
+    clockStatus->setTooltip("Clock of the (first) publisher relative to this computer: drift, and jitter of the packet "
+                            "arrival times around the estimate used for the sample timestamps");
+    addAndMakeVisible(clockStatus);
+
+}
+
+void FalconInputEditor::reconnect()
+{
+    node->tryToConnect();
+
+    if (node->auto_configure)
+        CoreServices::updateSignalChain(this);
+}
+
+void FalconInputEditor::updateSettings()
+{
+    channelCountInput->setText(String(node->num_channels), dontSendNotification);
+    sampleRateInput->setText(String((int) node->sample_rate), dontSendNotification);
+}
+
+void FalconInputEditor::timerCallback()
+{
+    latencyStatus->setText("One-way " + String(node->getPacketLatency().getSummary())
+                           + "\nDecode " + String(node->getDecodeLatency().getSummary()),
+                           dontSendNotification);
+
+    receiveStatus->setText("CPU " + String(node->getReceiveCpu(), 1) + "%", dontSendNotification);
+
+    gapStatus->setText(String(node->getLostPackets()) + " packets\n" + String(node->getLostSamples()) + " samples",
+                       dontSendNotification);
+
+    clockStatus->setText("Drift " + String(node->getClockDriftPpm(), 1) + " ppm\nJitter "
+                         + String(node->getClockJitter(), 0) + " us",
+                         dontSendNotification);
+}
+
+void FalconInputEditor::updateAddressField()
+{
+    const bool ipc = node->transport == ZmqTransport::IPC;
+
+    addressLabel->setText(ipc ? "IPC Path" : "IP Address", dontSendNotification);
+    addressInput->setText(ipc ? node->ipc_path : node->address, dontSendNotification);
+
+    // inproc and shm are identified by the port alone
+    addressInput->setEnabled(node->transport == ZmqTransport::TCP || ipc);
+}
+
+void FalconInputEditor::comboBoxChanged(ComboBox* comboBox)
+{
+    if (comboBox == transportSelector)
+    {
+        node->transport = transportSelector->getSelectedId() - 1;
+        updateAddressField();
+        reconnect();
+    }
+    else if (comboBox == receiveSelector)
+    {
+        node->receive_mode = receiveSelector->getSelectedId() - 1;
+    }
+    else if (comboBox == gapSelector)
+    {
+        node->gap_policy = gapSelector->getSelectedId() - 1;
+    }
 }
 
 void FalconInputEditor::labelTextChanged(Label* label)
@@ -137,7 +357,7 @@ void FalconInputEditor::labelTextChanged(Label* label)
         if (port > 1023 && port < 65535)
         {
             node->port = port;
-            node->tryToConnect();
+            reconnect();
         }
         else {
             portInput->setText(String(node->port), dontSendNotification);
@@ -145,8 +365,22 @@ void FalconInputEditor::labelTextChanged(Label* label)
     }
     else if (label == addressInput)
     {
-        node->address = addressInput->getText();
-        node->tryToConnect();
+        if (node->transport == ZmqTransport::IPC)
+            node->ipc_path = addressInput->getText();
+        else
+            node->address = addressInput->getText();
+
+        reconnect();
+    }
+    else if (label == streamInput)
+    {
+        node->stream_name = streamInput->getText();
+        reconnect();
+    }
+    else if (label == endpointsInput)
+    {
+        node->endpoints = endpointsInput->getText().trim();
+        reconnect();
     }
 
 }
@@ -158,6 +392,16 @@ void FalconInputEditor::startAcquisition()
     portInput->setEnabled(false);
     channelCountInput->setEnabled(false);
     sampleRateInput->setEnabled(false);
+    autoConfigureButton->setEnabled(false);
+    refreshButton->setEnabled(false);
+    streamInput->setEnabled(false);
+    endpointsInput->setEnabled(false);
+    transportSelector->setEnabled(false);
+    receiveSelector->setEnabled(false);
+    socketButton->setEnabled(false);
+    gapSelector->setEnabled(false);
+
+    startTimer(200);
 
 }
 
@@ -166,23 +410,80 @@ void FalconInputEditor::stopAcquisition()
     // Reenable the whole gui
     addressInput->setEnabled(true);
     portInput->setEnabled(true);
-    channelCountInput->setEnabled(true);
-    sampleRateInput->setEnabled(true);
+    channelCountInput->setEnabled(!node->auto_configure);
+    sampleRateInput->setEnabled(!node->auto_configure);
+    autoConfigureButton->setEnabled(true);
+    refreshButton->setEnabled(node->auto_configure);
+    streamInput->setEnabled(true);
+    endpointsInput->setEnabled(true);
+    transportSelector->setEnabled(true);
+    receiveSelector->setEnabled(true);
+    socketButton->setEnabled(true);
+    gapSelector->setEnabled(true);
+    updateAddressField();
+
+    stopTimer();
+    timerCallback();
 }
 
 void FalconInputEditor::buttonClicked(Button* button)
 {
-  
+    if (button == socketButton)
+    {
+        auto panel = std::make_unique<SocketOptionsPanel>(node->socket_options, false,
+            [this](const ZmqTransport::SocketOptions& options)
+            {
+                node->socket_options = options;
+                reconnect();
+            });
+
+        CallOutBox::launchAsynchronously(std::move(panel), socketButton->getScreenBounds(), nullptr);
+    }
+    else if (button == latencyCsvButton)
+    {
+        node->save_latency_csv = latencyCsvButton->getToggleState();
+    }
+    else if (button == autoConfigureButton)
+    {
+        node->auto_configure = autoConfigureButton->getToggleState();
+        channelCountInput->setEnabled(!node->auto_configure);
+        sampleRateInput->setEnabled(!node->auto_configure);
+        refreshButton->setEnabled(node->auto_configure);
+
+        if (node->auto_configure)
+            node->refreshStreams();
+
+        CoreServices::updateSignalChain(this);
+    }
+    else if (button == refreshButton)
+    {
+        node->refreshStreams();
+        CoreServices::updateSignalChain(this);
+    }
 }
 
 void FalconInputEditor::saveCustomParametersToXml(XmlElement* xmlNode)
 {
     XmlElement* parameters = xmlNode->createNewChildElement("PARAMETERS");
 
-    parameters->setAttribute("address", addressInput->getText());
+    parameters->setAttribute("address", node->address);
+    parameters->setAttribute("transport", node->transport);
+    parameters->setAttribute("ipc_path", node->ipc_path);
     parameters->setAttribute("port", portInput->getText());
     parameters->setAttribute("numchan", channelCountInput->getText());
     parameters->setAttribute("fs", sampleRateInput->getText());
+    parameters->setAttribute("stream", streamInput->getText());
+    parameters->setAttribute("endpoints", node->endpoints);
+    parameters->setAttribute("latency_csv", node->save_latency_csv);
+    parameters->setAttribute("auto_configure", node->auto_configure);
+    parameters->setAttribute("receive_mode", node->receive_mode);
+    parameters->setAttribute("gap_policy", node->gap_policy);
+    parameters->setAttribute("recv_hwm", node->socket_options.highWaterMark);
+    parameters->setAttribute("recv_buffer", node->socket_options.bufferSize);
+    parameters->setAttribute("io_threads", node->socket_options.ioThreads);
+    parameters->setAttribute("affinity", String((int64) node->socket_options.affinity));
+    parameters->setAttribute("conflate", node->socket_options.conflate);
+    parameters->setAttribute("tcp_keepalive", node->socket_options.tcpKeepalive);
 }
 
 void FalconInputEditor::loadCustomParametersFromXml(XmlElement* xmlNode)
@@ -192,8 +493,12 @@ void FalconInputEditor::loadCustomParametersFromXml(XmlElement* xmlNode)
         if (subNode->hasTagName("PARAMETERS"))
         {
 
-            addressInput->setText(subNode->getStringAttribute("address", DEFAULT_ADDRESS), dontSendNotification);
             node->address = subNode->getStringAttribute("address", DEFAULT_ADDRESS);
+            node->ipc_path = subNode->getStringAttribute("ipc_path", DEFAULT_IPC_PATH);
+            node->transport = jlimit(0, int(ZmqTransport::SHARED_MEMORY), subNode->getIntAttribute("transport", ZmqTransport::TCP));
+
+            transportSelector->setSelectedId(node->transport + 1, dontSendNotification);
+            updateAddressField();
 
             portInput->setText(subNode->getStringAttribute("port", String(DEFAULT_PORT)), dontSendNotification);
             node->port = subNode->getIntAttribute("port", DEFAULT_PORT);
@@ -204,6 +509,37 @@ void FalconInputEditor::loadCustomParametersFromXml(XmlElement* xmlNode)
             sampleRateInput->setText(subNode->getStringAttribute("fs", String(DEFAULT_SAMPLE_RATE)), dontSendNotification);
             node->sample_rate = subNode->getDoubleAttribute("fs", DEFAULT_SAMPLE_RATE);
 
+            streamInput->setText(subNode->getStringAttribute("stream"), dontSendNotification);
+            node->stream_name = subNode->getStringAttribute("stream");
+
+            node->endpoints = subNode->getStringAttribute("endpoints");
+            endpointsInput->setText(node->endpoints, dontSendNotification);
+
+            node->save_latency_csv = subNode->getBoolAttribute("latency_csv", false);
+            latencyCsvButton->setToggleState(node->save_latency_csv, dontSendNotification);
+
+            node->auto_configure = subNode->getBoolAttribute("auto_configure", false);
+            autoConfigureButton->setToggleState(node->auto_configure, dontSendNotification);
+            channelCountInput->setEnabled(!node->auto_configure);
+            sampleRateInput->setEnabled(!node->auto_configure);
+            refreshButton->setEnabled(node->auto_configure);
+
+            node->receive_mode = jlimit(0, int(FalconInput::RECEIVE_ADAPTIVE), subNode->getIntAttribute("receive_mode", FalconInput::RECEIVE_POLL));
+            receiveSelector->setSelectedId(node->receive_mode + 1, dontSendNotification);
+
+            node->gap_policy = jlimit(0, int(FalconInput::GAP_IGNORE), subNode->getIntAttribute("gap_policy", FalconInput::GAP_FILL_ZEROS));
+            gapSelector->setSelectedId(node->gap_policy + 1, dontSendNotification);
+
+            ZmqTransport::SocketOptions defaults;
+            node->socket_options.highWaterMark = jmax(0, subNode->getIntAttribute("recv_hwm", defaults.highWaterMark));
+            node->socket_options.bufferSize = jmax(0, subNode->getIntAttribute("recv_buffer", defaults.bufferSize));
+            node->socket_options.ioThreads = jlimit(1, 16, subNode->getIntAttribute("io_threads", defaults.ioThreads));
+            node->socket_options.affinity = uint64(subNode->getStringAttribute("affinity", "0").getLargeIntValue());
+            node->socket_options.conflate = subNode->getBoolAttribute("conflate", defaults.conflate);
+            node->socket_options.tcpKeepalive = subNode->getBoolAttribute("tcp_keepalive", defaults.tcpKeepalive);
+
+            node->tryToConnect();
+
         }
     }
 }
@@ -35,7 +35,9 @@ class FalconInput;
 
 class FalconInputEditor : public GenericEditor, 
                             public Label::Listener,
-                            public Button::Listener
+                            public Button::Listener,
+                            public ComboBox::Listener,
+                            public Timer
 {
 
 public:
@@ -61,6 +63,15 @@ public:
     /** Called when label is changed */
     void labelTextChanged(Label* label);
 
+    /** Called when the transport is changed */
+    void comboBoxChanged(ComboBox* comboBox);
+
+    /** Refreshes the latency statistics during acquisition */
+    void timerCallback();
+
+    /** Shows the channel count and sample rate, which auto-configure may have changed */
+    void updateSettings() override;
+
 private:
 
     // Address
@@ -70,15 +81,52 @@ private:
     // Port
     ScopedPointer<Label> portLabel;
     ScopedPointer<Label> portInput;
+    ScopedPointer<UtilityButton> refreshButton;
 
     // Chans
     ScopedPointer<Label> channelCountLabel;
     ScopedPointer<Label> channelCountInput;
+    ScopedPointer<ToggleButton> autoConfigureButton;
 
     // Fs
     ScopedPointer<Label> sampleRateLabel;
     ScopedPointer<Label> sampleRateInput;
 
+    // Stream
+    ScopedPointer<Label> streamLabel;
+    ScopedPointer<Label> streamInput;
+
+    // Transport
+    ScopedPointer<Label> transportLabel;
+    ScopedPointer<ComboBox> transportSelector;
+
+    // Latency
+    ScopedPointer<Label> latencyLabel;
+    ScopedPointer<Label> latencyStatus;
+    ScopedPointer<ToggleButton> latencyCsvButton;
+
+    // Receive mode
+    ScopedPointer<Label> receiveLabel;
+    ScopedPointer<ComboBox> receiveSelector;
+    ScopedPointer<Label> receiveStatus;
+    ScopedPointer<UtilityButton> socketButton;
+
+    // Further publishers
+    ScopedPointer<Label> endpointsLabel;
+    ScopedPointer<Label> endpointsInput;
+    ScopedPointer<Label> clockStatus;
+
+    // Lost packets
+    ScopedPointer<Label> gapLabel;
+    ScopedPointer<ComboBox> gapSelector;
+    ScopedPointer<Label> gapStatus;
+
+    /** Reconnects with the current settings, and reconfigures from the stream if auto-configure is on */
+    void reconnect();
+
+    /** Shows either the IP address or the IPC path in the address field, depending on the transport */
+    void updateAddressField();
+
     // Parent node
     FalconInput* node;
 
@@ -24,29 +24,131 @@
 
 
 #include "FalconOutput.h"
+#include "HostClock.h"
+#include "ZmqTransport.h"
+
+FalconSenderThread::FalconSenderThread(FalconOutput* processor_)
+    : Thread("Falcon Output Sender"),
+      processor(processor_)
+{
+}
+
+void FalconSenderThread::run()
+{
+    while (!threadShouldExit())
+    {
+        processor->sendQueuedBlocks();
+        wait(5);
+    }
+
+    processor->sendQueuedBlocks();
+}
 
 FalconOutput::FalconOutput()
     : GenericProcessor("Falcon Output"),
-      flatBuilder(1024),
       selectedStream(0)
 {
     context = zmq_ctx_new();
     socket = 0;
+    zeroCopy = true;
+    sampleMajor = false;
+    sampleFormat = FLOAT32;
+    compression = 0;
+    eventFormat = PER_SAMPLE_EVENTS;
+    forwardSpikes = false;
+    forwardMessages = false;
+    timestampClock = HostClock::STEADY;
+    hardwareTimestamps = false;
+    asyncMode = false;
+    multiStream = false;
+    latencyCsv = false;
+    droppedBlocks = 0;
     flag = 0;
-    messageNumber = 0;
     port = 3335;
+    transport = ZmqTransport::TCP;
+    ipcPath = "/tmp/falcon-output";
 
     if (!socket)
         createSocket();
 
+    senderThread = std::make_unique<FalconSenderThread>(this);
+
     addMaskChannelsParameter(Parameter::STREAM_SCOPE, "Channels", "The input channel data to send", true);
 
+    addStringParameter(Parameter::STREAM_SCOPE, "groups",
+                       "Output groups sent instead of the channel selection, e.g. \"ripple: 1-4, 9; monitor: 33\"; each name is its topic",
+                       "", true);
+
+    addCategoricalParameter(Parameter::STREAM_SCOPE, "decimation",
+                            "Low-pass filter and keep every n-th sample of the stream before sending it",
+                            { "1", "2", "3", "4", "5", "6", "8", "10", "12", "15", "20", "30" }, 0, true);
+
     addIntParameter(Parameter::GLOBAL_SCOPE, "data_port", "Port number to send data", port, 1000, 65535, true);
 
+    StringArray transports = { "tcp", "ipc", "inproc" };
+#ifndef _WIN32
+    transports.add("shm");
+#endif
+
+    addCategoricalParameter(Parameter::GLOBAL_SCOPE, "transport",
+                            "tcp for remote hosts, ipc or shm (shared memory) for the same host, inproc for the same process",
+                            transports, ZmqTransport::TCP, true);
+
+    addStringParameter(Parameter::GLOBAL_SCOPE, "ipc_path", "Socket file used by the ipc transport", String(ipcPath), true);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE, "zero_copy", "Hand encoded packets to ZMQ without copying them", true);
+
+    addCategoricalParameter(Parameter::GLOBAL_SCOPE, "sample_format", "Encoding of the samples in each packet",
+                            { "float32", "int16" }, FLOAT32, true);
+
+    addCategoricalParameter(Parameter::GLOBAL_SCOPE, "compression", "Lossless compression of the samples in each packet",
+                            { "none", "delta_bitpack" }, 0, true);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE, "sample_major", "Send samples interleaved across channels", false, true);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE, "async_send", "Encode and send packets on a separate thread", false, true);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE, "multi_stream", "Send all enabled streams, each prefixed by a topic frame with its name", false, true);
+
+    addCategoricalParameter(Parameter::GLOBAL_SCOPE, "event_format",
+                            "per_sample: TTL lines 0-15 as one code per sample; sparse: only the changes of lines 0-63",
+                            { "per_sample", "sparse" }, PER_SAMPLE_EVENTS, true);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE, "forward_spikes", "Publish incoming spikes on the \"spikes\" topic", false, true);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE, "forward_messages", "Publish broadcast text messages on the \"messages\" topic", false, true);
+
+    addCategoricalParameter(Parameter::GLOBAL_SCOPE, "timestamp_clock",
+                            "Host clock of the timestamp_ns, enqueued_ns and sent_ns fields of each packet",
+                            { "steady", "monotonic_raw", "tai" }, HostClock::STEADY, true);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE, "hardware_timestamp",
+                        "Also send the upstream timestamp of the first sample of each block", false, true);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE, "latency_csv", "Write the encode and send time histograms to a CSV file when acquisition stops", false);
+
+    // Advanced ZeroMQ settings, edited in the Socket panel of the editor
+    addIntParameter(Parameter::GLOBAL_SCOPE, "send_hwm", "Packets queued per subscriber before new ones are dropped (0 = no limit)",
+                    socketOptions.highWaterMark, 0, 10000000, true);
+
+    addIntParameter(Parameter::GLOBAL_SCOPE, "send_buffer", "Kernel send buffer in bytes (0 = OS default)",
+                    socketOptions.bufferSize, 0, 256 * 1024 * 1024, true);
+
+    addIntParameter(Parameter::GLOBAL_SCOPE, "io_threads", "Background threads of the ZeroMQ context",
+                    socketOptions.ioThreads, 1, 16, true);
+
+    addIntParameter(Parameter::GLOBAL_SCOPE, "affinity", "Bitmask of the I/O threads that serve the socket (0 = any)",
+                    0, 0, 0xffff, true);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE, "conflate", "Only keep the latest packet for each subscriber (single-stream only)", false, true);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE, "tcp_keepalive", "Enable TCP keepalive on subscriber connections", false, true);
+
 }
 
 FalconOutput::~FalconOutput()
 {
+    senderThread->stopThread(1000);
     closeSocket();
     if (context)
     {
@@ -57,9 +159,23 @@ FalconOutput::~FalconOutput()
 
 void FalconOutput::createSocket()
 {
+    if (transport == ZmqTransport::SHARED_MEMORY)
+    {
+        if (!sharedMemory.isOpen()
+            && !sharedMemory.create(SharedMemoryRing::getSegmentName(port), SHM_RING_SLOTS, SHM_INITIAL_SLOT_SIZE))
+        {
+            LOGE("Couldn't create shared memory segment ", SharedMemoryRing::getSegmentName(port));
+        }
+
+        return;
+    }
+
     if (!socket)
     {
-        socket = zmq_socket(context, ZMQ_PUB);
+        // inproc endpoints are only visible to sockets of the same context
+        void* socketContext = transport == ZmqTransport::INPROC ? ZmqTransport::getSharedContext() : context;
+
+        socket = zmq_socket(socketContext, ZMQ_PUB);
 
         if (!socket)
         {
@@ -68,7 +184,18 @@ void FalconOutput::createSocket()
             jassert(false);
         }
 
-        auto urlstring = "tcp://*:" + std::to_string(port);
+        // Conflation drops message parts, so it would separate packets from their topic frames
+        ZmqTransport::SocketOptions options = socketOptions;
+
+        if (options.conflate && (sendsTopics() || forwardSpikes || forwardMessages))
+        {
+            LOGC("Falcon Output ignores conflate in multi-stream mode, with output groups and when forwarding spikes or messages");
+            options.conflate = false;
+        }
+
+        ZmqTransport::applySocketOptions(socket, options, true);
+
+        auto urlstring = ZmqTransport::getBindEndpoint(ZmqTransport::Type(transport), port, ipcPath);
 
         if (zmq_bind(socket, urlstring.c_str()))
         {
@@ -87,47 +214,126 @@ void FalconOutput::closeSocket()
         zmq_close(socket);
         socket = 0;
     }
+
+    sharedMemory.close();
 }
 
-void FalconOutput::sendData(const float **bufferChanPtrs,
-                            int nChannels, int nSamples,
-                            int64 sampleNumber, double timestamp, int sampleRate)
+void FalconOutput::sendData(StreamOutput& output, const float **bufferChanPtrs,
+                            int nSamples, const PacketEvents& events,
+                            int64 sampleNumber, PacketTimes times)
 {
-    
-    messageNumber++;
+    const int nChannels = output.globalChannels.size();
+    const int64 encodeStart = Time::getHighResolutionTicks();
+
+    // Provisional, so that the field is written; it is overwritten in place just before sending
+    const HostClock::Type clock = HostClock::Type(times.clock);
+    times.sentNs = HostClock::nowNanoseconds(clock);
+
+    output.messageNumber++;
+
+    PacketFormat format;
+    format.sampleMajor = sampleMajor;
+    format.int16Samples = sampleFormat == INT16;
+    format.compressed = compression == openephysflatbuffer::Compression_DeltaBitPack;
+
+    encoder.encode(format, bufferChanPtrs, nChannels, nSamples, output.bitVolts.data(), events,
+                   output.name, sampleNumber, times, output.messageNumber, output.sampleRate);
 
-    // Create message
-    std::vector<float> flatsamples;
-    flatsamples.reserve(nChannels * nSamples);
+    flatbuffers::FlatBufferBuilder& flatBuilder = encoder.getBuilder();
 
-    for (int ch = 0; ch < nChannels; ch++)
+    const int64 sendStart = Time::getHighResolutionTicks();
+    encodeLatency.record(Time::highResolutionTicksToSeconds(sendStart - encodeStart) * 1.0e6);
+
+    if (transport == ZmqTransport::SHARED_MEMORY)
     {
-        for (int i = 0; i < nSamples; i++)
-            flatsamples.push_back(*(*(bufferChanPtrs + ch) + i));
-    }
+        // Readers filter streams on the packet's stream field, so no topic is needed
+        uint8_t* buf = flatBuilder.GetBufferPointer();
+        const size_t size = flatBuilder.GetSize();
 
-    auto samples = flatBuilder.CreateVector(flatsamples);
-    auto event_codes = flatBuilder.CreateVector(eventCodes);
+        openephysflatbuffer::GetMutableContinuousData(buf)->mutate_sent_ns(HostClock::nowNanoseconds(clock));
 
-    auto streamName = flatBuilder.CreateString(getDataStream(selectedStream)->getName().toStdString());
-    auto zmqBuffer = openephysflatbuffer::CreateContinuousData(flatBuilder, samples, event_codes, streamName,
-                                                               nChannels, nSamples, sampleNumber, timestamp,
-                                                               messageNumber, sampleRate);
-    flatBuilder.Finish(zmqBuffer);
+        if (!sharedMemory.write(buf, size))
+        {
+            // Packet larger than the slots: the readers follow the writer to a larger segment
+            if (sharedMemory.create(SharedMemoryRing::getSegmentName(port), SHM_RING_SLOTS, size * 2))
+                sharedMemory.write(buf, size);
+        }
 
-    uint8_t *buf = flatBuilder.GetBufferPointer();
-    int size = flatBuilder.GetSize();
+        flatBuilder.Clear();
+        sendLatency.record(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - sendStart) * 1.0e6);
+        return;
+    }
 
-    // Send packet
     zmq_msg_t request;
-    zmq_msg_init_size(&request, size);
-    memcpy(zmq_msg_data(&request), (void *)buf, size);
+
+    if (zeroCopy)
+    {
+        // Lend the builder's buffer to ZMQ, which gives it back to the encoder once it has been sent
+        void* hint = encoder.holdPacket();
+
+        if (zmq_msg_init_data(&request, flatBuilder.GetBufferPointer(), flatBuilder.GetSize(),
+                              PacketEncoder::releasePacket, hint))
+        {
+            PacketEncoder::releasePacket(nullptr, hint);
+            return;
+        }
+    }
+    else
+    {
+        uint8_t *buf = flatBuilder.GetBufferPointer();
+        int size = flatBuilder.GetSize();
+
+        zmq_msg_init_size(&request, size);
+        memcpy(zmq_msg_data(&request), (void *)buf, size);
+        flatBuilder.Clear();
+    }
+
+    // Send packet, preceded by its topic so that subscribers can filter streams
+    if (output.sendTopic)
+        zmq_send(socket, output.name.data(), output.name.size(), ZMQ_SNDMORE);
+
+    openephysflatbuffer::GetMutableContinuousData(zmq_msg_data(&request))->mutate_sent_ns(HostClock::nowNanoseconds(clock));
+
     int size_m = zmq_msg_send(&request, socket, 0);
     zmq_msg_close(&request);
 
-    //std::cout << "Sending packet " << messageNumber << " at " << Time::getHighResolutionTicks() << std::endl;
+    sendLatency.record(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - sendStart) * 1.0e6);
+}
+
+void FalconOutput::sendQueuedBlocks()
+{
+    while (SampleBlock* block = sendRing.beginRead())
+    {
+        if (block->output < 0)
+        {
+            sendSidePackets(block->sidePackets);
+            sendRing.commitRead();
+            continue;
+        }
+
+        for (int ch = 0; ch < block->numChannels; ch++)
+            senderPtrs[ch] = block->samples.data() + ch * block->numSamples;
 
-    flatBuilder.Clear();
+        PacketEvents events;
+
+        if (eventFormat == SPARSE_EVENTS)
+        {
+            events.ttlWord = block->ttlWord;
+            events.ttlEvents = block->ttlEvents.data();
+            events.numTtlEvents = int(block->ttlEvents.size());
+        }
+        else
+        {
+            events.codes = block->eventCodes.data();
+        }
+
+        sendData(*outputs[block->output], senderPtrs, block->numSamples, events,
+                 block->sampleNumber, block->times);
+
+        sendSidePackets(block->sidePackets);
+
+        sendRing.commitRead();
+    }
 }
 
 AudioProcessorEditor* FalconOutput::createEditor()
@@ -146,108 +352,643 @@ void FalconOutput::updateSettings()
     ed->updateStreamSelectorOptions();
 }
 
+std::vector<OutputGroup> FalconOutput::parseGroups(const String& spec, int numChannels)
+{
+    std::vector<OutputGroup> groups;
+
+    for (auto entry : StringArray::fromTokens(spec, ";\n", ""))
+    {
+        if (entry.trim().isEmpty())
+            continue;
+
+        OutputGroup group;
+        group.name = entry.upToFirstOccurrenceOf(":", false, false).trim();
+
+        for (auto range : StringArray::fromTokens(entry.fromFirstOccurrenceOf(":", false, false), ",", ""))
+        {
+            range = range.trim();
+
+            if (range.isEmpty())
+                continue;
+
+            int first = range.upToFirstOccurrenceOf("-", false, false).getIntValue();
+            int last = range.contains("-") ? range.fromFirstOccurrenceOf("-", false, false).getIntValue() : first;
+
+            for (int chan = jmax(1, first); chan <= jmin(last, numChannels); chan++)
+                group.channels.addIfNotAlreadyThere(chan - 1);
+        }
+
+        if (group.name.isEmpty() || group.channels.isEmpty())
+        {
+            LOGC("Falcon Output ignores the output group \"", entry.trim(), "\"");
+            continue;
+        }
+
+        // Clients tell spikes and messages apart from continuous data by these topics
+        if (group.name == ZmqTransport::SPIKE_TOPIC || group.name == ZmqTransport::MESSAGE_TOPIC)
+        {
+            LOGC("Falcon Output ignores the output group \"", entry.trim(), "\": its name is reserved for forwarded ",
+                 group.name);
+            continue;
+        }
+
+        groups.push_back(group);
+    }
+
+    return groups;
+}
+
+bool FalconOutput::sendsTopics()
+{
+    if (multiStream)
+        return true;
+
+    // Only the streams that startAcquisition() turns into outputs
+    for (auto stream : dataStreams)
+    {
+        if (!(*stream)["enable_stream"] || stream->getStreamId() != selectedStream)
+            continue;
+
+        Parameter* groups = stream->getParameter("groups");
+
+        if (groups != nullptr && groups->getValue().toString().trim().isNotEmpty())
+            return true;
+    }
+
+    return false;
+}
+
 void FalconOutput::handleTTLEvent(TTLEventPtr event)
 {
-    if (event->getStreamId() == selectedStream)
+    int eventLine = event->getLine();
+
+    if (eventLine > 63)
+        return;
+
+    // Per-sample codes only hold lines 0-15
+    if (eventFormat != SPARSE_EVENTS && eventLine > 15)
+        return;
+
+    bool eventState = event->getState();
+
+    // Every output group of the stream carries the events
+    for (auto output : outputs)
     {
-        int eventLine = event->getLine();
+        if (output->streamId != event->getStreamId())
+            continue;
 
-        if (eventLine > 15)
-            return;
+        int64 sampleOffset = event->getSampleNumber() - getFirstSampleNumberForBlock(output->streamId);
+        sampleOffset = jlimit(int64(0), jmax(int64(0), int64(output->eventCodes.size()) - 1), sampleOffset);
 
-        int64 sampleOffset = event->getSampleNumber() - getFirstSampleNumberForBlock(selectedStream);
-        bool eventState = event->getState();
+        if (eventFormat == SPARSE_EVENTS)
+        {
+            // Only the change is sent; the receiver rebuilds the state of every sample
+            const uint64 bit = uint64(1) << eventLine;
+            output->ttlWord = eventState ? (output->ttlWord | bit) : (output->ttlWord & ~bit);
+            output->ttlEvents.push_back(openephysflatbuffer::TtlEvent(uint32(sampleOffset), uint8(eventLine), eventState));
+            continue;
+        }
 
-        for (int i = lastEventIndex; i < sampleOffset - 1; i++)
+        for (int i = output->lastEventIndex; i < sampleOffset; i++)
         {
-            eventCodes[i] = lastEventCode;
+            output->eventCodes[i] = output->lastEventCode;
         }
 
         if (eventState)
         {
-            lastEventCode |= uint16(1) << eventLine;
+            output->lastEventCode |= uint16(1) << eventLine;
         }
         else {
-            lastEventCode &= ~(uint16(1) << eventLine);
+            output->lastEventCode &= ~(uint16(1) << eventLine);
         }
 
-        //std::cout << "Received event on line " << eventLine << "; new code = " << lastEventCode << ", sample offset = " << sampleOffset << std::endl;
+        //std::cout << "Received event on line " << eventLine << "; new code = " << output->lastEventCode << ", sample offset = " << sampleOffset << std::endl;
 
-        lastEventIndex = sampleOffset;
-        eventCodes[lastEventIndex] = lastEventCode;
+        output->lastEventIndex = sampleOffset;
+        output->eventCodes[output->lastEventIndex] = output->lastEventCode;
 
     }
 }
 
+void FalconOutput::handleSpike(SpikePtr spike)
+{
+    // Shared memory only carries continuous data: don't encode what would be thrown away
+    if (!forwardSpikes || transport == ZmqTransport::SHARED_MEMORY)
+        return;
+
+    const SpikeChannel* channel = spike->getChannelInfo();
+    const int numChannels = channel->getNumChannels();
+
+    spikeThresholds.resize(numChannels);
+
+    for (int ch = 0; ch < numChannels; ch++)
+        spikeThresholds[ch] = spike->getThreshold(ch);
+
+    DataStream* stream = getDataStream(spike->getStreamId());
+
+    sideEncoder.encodeSpike(stream != nullptr ? stream->getName().toRawUTF8() : "", channel->getName().toRawUTF8(),
+                            spike->getDataPointer(), numChannels, channel->getTotalSamples(), spikeThresholds.data(),
+                            spike->getSortedId(), spike->getSampleNumber(),
+                            Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks()),
+                            ++spikeMessageNumber, uint32(channel->getSampleRate()));
+
+    queueSidePacket(ZmqTransport::SPIKE_TOPIC);
+}
+
+void FalconOutput::handleBroadcastMessage(String msg)
+{
+    if (!forwardMessages || transport == ZmqTransport::SHARED_MEMORY)
+        return;
+
+    sideEncoder.encodeText(msg.toRawUTF8(), Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks()),
+                           ++textMessageNumber);
+
+    queueSidePacket(ZmqTransport::MESSAGE_TOPIC);
+}
+
+void FalconOutput::queueSidePacket(const char* topic)
+{
+    flatbuffers::FlatBufferBuilder& builder = sideEncoder.getBuilder();
+
+    // Each entry: topic length, topic, packet length, packet
+    const uint32 topicSize = uint32(strlen(topic));
+    const uint32 packetSize = uint32(builder.GetSize());
+
+    if (pendingSidePackets.size() + topicSize + packetSize > MAX_PENDING_SIDE_BYTES)
+    {
+        builder.Clear();
+        return;
+    }
+
+    const uint8* topicBytes = reinterpret_cast<const uint8*>(topic);
+
+    pendingSidePackets.insert(pendingSidePackets.end(), reinterpret_cast<const uint8*>(&topicSize),
+                              reinterpret_cast<const uint8*>(&topicSize) + sizeof(topicSize));
+    pendingSidePackets.insert(pendingSidePackets.end(), topicBytes, topicBytes + topicSize);
+    pendingSidePackets.insert(pendingSidePackets.end(), reinterpret_cast<const uint8*>(&packetSize),
+                              reinterpret_cast<const uint8*>(&packetSize) + sizeof(packetSize));
+    pendingSidePackets.insert(pendingSidePackets.end(), builder.GetBufferPointer(), builder.GetBufferPointer() + packetSize);
+
+    builder.Clear();
+}
+
+void FalconOutput::sendSidePackets(const std::vector<uint8>& packets)
+{
+    // The shared memory ring only carries continuous data
+    if (!socket || transport == ZmqTransport::SHARED_MEMORY)
+        return;
+
+    size_t position = 0;
+
+    while (position + 2 * sizeof(uint32) <= packets.size())
+    {
+        uint32 topicSize, packetSize;
+
+        memcpy(&topicSize, packets.data() + position, sizeof(topicSize));
+        const uint8* topic = packets.data() + position + sizeof(topicSize);
+
+        memcpy(&packetSize, topic + topicSize, sizeof(packetSize));
+        const uint8* packet = topic + topicSize + sizeof(packetSize);
+
+        zmq_send(socket, topic, topicSize, ZMQ_SNDMORE);
+        zmq_send(socket, packet, packetSize, 0);
+
+        position = size_t(packet + packetSize - packets.data());
+    }
+}
+
 void FalconOutput::process(AudioBuffer<float>& buffer)
 {
-    if (!socket)
+    if (!socket && !sharedMemory.isOpen() && !asyncMode)
         createSocket();
 
-    eventCodes.resize(getNumSamplesInBlock(selectedStream));
-    lastEventIndex = 0;
-    checkForEvents();
+    // Taken before anything else, so that the latency seen by clients includes the handling of events
+    PacketTimes times;
+    times.timestamp = double(Time::getHighResolutionTicks()) / double(Time::getHighResolutionTicksPerSecond());
+    times.clock = openephysflatbuffer::TimestampClock(timestampClock);
+    times.timestampNs = HostClock::nowNanoseconds(HostClock::Type(timestampClock));
+    times.enqueuedNs = times.timestampNs;
 
-    for (int i = lastEventIndex; i < getNumSamplesInBlock(selectedStream); i++)
-        eventCodes[i] = lastEventCode;
+    for (auto output : outputs)
+    {
+        output->eventCodes.resize(getNumSamplesInBlock(output->streamId));
+        output->lastEventIndex = 0;
+        output->blockTtlWord = output->ttlWord;
+        output->ttlEvents.clear();
+    }
 
-    for (auto stream : dataStreams)
-    {        
-        if ((*stream)["enable_stream"]
-            && stream->getStreamId() == selectedStream)
+    checkForEvents(forwardSpikes);
+
+    for (int index = 0; index < outputs.size(); index++)
+    {
+        StreamOutput* output = outputs[index];
+
+        int numSamples = getNumSamplesInBlock(output->streamId);
+        int numChannels = output->globalChannels.size();
+
+        for (int i = output->lastEventIndex; i < numSamples; i++)
+            output->eventCodes[i] = output->lastEventCode;
+
+        if(numSamples == 0)
+            continue;
+
+        // Send the sample number of the first sample in the buffer block
+        int64 sampleNum = getFirstSampleNumberForBlock(output->streamId);
+
+        times.hardwareTimestamp = hardwareTimestamps ? getFirstTimestampForBlock(output->streamId) : -1.0;
+        times.lastSampleAge = 0.0;
+
+        for (int ch = 0; ch < numChannels; ch++)
+            bufferPtrs[ch] = buffer.getReadPointer(output->globalChannels[ch]);
+
+        Decimator& decimator = output->decimator;
+
+        if (decimator.getFactor() > 1)
         {
-            // Send the sample number of the first sample in the buffer block
-            int64 sampleNum = getFirstSampleNumberForBlock(selectedStream) ;
-            double timestamp = double(Time::getHighResolutionTicks()) / double(Time::getHighResolutionTicksPerSecond());
-            int numSamples = getNumSamplesInBlock(selectedStream);
-            int numChannels = selectedChannels.size();
+            const int factor = decimator.getFactor();
+            const int64 firstOutput = decimator.getOutputSampleNumber(sampleNum);
+            const int numOutputs = decimator.getNumOutputSamples(sampleNum, numSamples);
+
+            if (output->decimated.size() < size_t(numChannels) * numOutputs)
+                output->decimated.resize(size_t(numChannels) * numOutputs);
+
+            decimator.process(bufferPtrs, numSamples, sampleNum, output->decimated.data(), numOutputs);
 
-            if(numSamples == 0)
+            // TTL codes and changes go through the filter delay too, so that they stay aligned with the samples
+            decimator.processCodes(output->eventCodes.data(), numSamples, sampleNum);
+
+            for (const auto& event : output->ttlEvents)
+                decimator.addEvent(sampleNum + event.sample_offset(), event.line(), event.state());
+
+            output->ttlEvents.clear();
+
+            // Too short a block may hold no kept sample; the filter state and the TTL state carry over
+            if (numOutputs == 0)
                 continue;
 
-            int i = 0;
-            for(auto chan : selectedChannels)
+            for (int ch = 0; ch < numChannels; ch++)
+                bufferPtrs[ch] = output->decimated.data() + ch * numOutputs;
+
+            output->blockTtlWord = output->delayedTtlWord;
+            Decimator::Event event;
+
+            while (decimator.takeEvent(firstOutput + numOutputs, event))
             {
-                int globalChanIndex = stream->getContinuousChannels().getUnchecked(chan)->getGlobalIndex();
+                const uint32 offset = uint32(jmax(int64(0), event.sampleNumber - firstOutput));
+                output->ttlEvents.push_back(openephysflatbuffer::TtlEvent(offset, uint8(event.line), event.state));
 
-                bufferPtrs[i] = buffer.getReadPointer(globalChanIndex);
+                if (event.state)
+                    output->delayedTtlWord |= uint64(1) << event.line;
+                else
+                    output->delayedTtlWord &= ~(uint64(1) << event.line);
+            }
+
+            // The first sample sent shows input sample firstOutput * factor
+            if (times.hardwareTimestamp >= 0.0)
+                times.hardwareTimestamp += double(firstOutput * factor - sampleNum) / (double(output->sampleRate) * factor);
+
+            // timestamp is taken once the last input sample has arrived; the last sample sent shows an older one
+            times.lastSampleAge = double(decimator.getLastOutputAge(sampleNum, numSamples))
+                                  / (double(output->sampleRate) * factor);
+
+            sampleNum = firstOutput;
+            numSamples = numOutputs;
+        }
+
+        if (asyncMode)
+        {
+            // Only copy the block here; the sender thread encodes and sends it
+            SampleBlock* block = sendRing.beginWrite();
+
+            if (block == nullptr)
+            {
+                droppedBlocks++;
+                continue;
+            }
+
+            block->prepare(numChannels, numSamples);
+
+            for (int ch = 0; ch < numChannels; ch++)
+                memcpy(block->samples.data() + ch * numSamples, bufferPtrs[ch], numSamples * sizeof(float));
+
+            memcpy(block->eventCodes.data(), output->eventCodes.data(), numSamples * sizeof(uint16));
+            block->ttlWord = output->blockTtlWord;
+            block->ttlEvents.assign(output->ttlEvents.begin(), output->ttlEvents.end());
+
+            // Spikes and messages go with the first block of this buffer, to keep a single sending thread
+            block->sidePackets.assign(pendingSidePackets.begin(), pendingSidePackets.end());
+            pendingSidePackets.clear();
 
-                i++;
+            block->output = index;
+            block->sampleNumber = sampleNum;
+            block->times = times;
+            block->times.enqueuedNs = HostClock::nowNanoseconds(HostClock::Type(timestampClock));
+
+            sendRing.commitWrite();
+            senderThread->notify();
+        }
+        else
+        {
+            PacketEvents events;
+
+            if (eventFormat == SPARSE_EVENTS)
+            {
+                events.ttlWord = output->blockTtlWord;
+                events.ttlEvents = output->ttlEvents.data();
+                events.numTtlEvents = int(output->ttlEvents.size());
             }
+            else
+            {
+                events.codes = output->eventCodes.data();
+            }
+
+            sendData(*output, bufferPtrs, numSamples, events, sampleNum, times);
+        }
+    }
+
+    if (!asyncMode)
+    {
+        sendSidePackets(pendingSidePackets);
+        pendingSidePackets.clear();
+    }
+    else if (!pendingSidePackets.empty())
+    {
+        // No block of this buffer carried them (no output, or no sample kept): hand them over in a slot of their own
+        if (SampleBlock* block = sendRing.beginWrite())
+        {
+            block->output = -1;
+            block->sidePackets.assign(pendingSidePackets.begin(), pendingSidePackets.end());
+            pendingSidePackets.clear();
 
-            sendData(bufferPtrs, numChannels, numSamples, sampleNum, timestamp, (int)stream->getSampleRate());
+            sendRing.commitWrite();
+            senderThread->notify();
         }
     }
 }
 
 bool FalconOutput::startAcquisition()
 {
-    lastEventCode = 0;
+    outputs.clear();
+
+    encodeLatency.reset();
+    sendLatency.reset();
+
+    int maxChannels = 0;
+    int maxNameLength = 0;
+
+    // No stream has more samples in a block than the audio buffer; a larger block grows the buffers once
+    const int blockSamples = getBlockSize() > 0 ? getBlockSize() : RESERVED_BLOCK_SAMPLES;
+
+    for (auto stream : dataStreams)
+    {
+        if (!(*stream)["enable_stream"])
+            continue;
+
+        if (!multiStream && stream->getStreamId() != selectedStream)
+            continue;
+
+        // Without groups, the stream is sent as a whole with its channel selection;
+        // otherwise every group becomes an output that reads its own channels from the same buffer
+        std::vector<OutputGroup> groups = parseGroups(stream->getParameter("groups")->getValue().toString(),
+                                                      stream->getChannelCount());
+
+        if (groups.empty())
+        {
+            OutputGroup whole;
+            whole.name = stream->getName();
+            whole.channels = static_cast<MaskChannelsParameter*>(stream->getParameter("Channels"))->getArrayValue();
+            groups.push_back(whole);
+        }
+
+        int factor = static_cast<CategoricalParameter*>(stream->getParameter("decimation"))->getSelectedString().getIntValue();
+
+        // Packets carry an integer sample rate, so the factor has to divide the stream's rate exactly
+        const int sampleRate = roundToInt(stream->getSampleRate());
+
+        if (factor > 1 && (double(sampleRate) != stream->getSampleRate() || sampleRate % factor != 0))
+        {
+            LOGC("Falcon Output: decimation by ", factor, " does not divide the ", stream->getSampleRate(),
+                 " Hz rate of ", stream->getName(), "; sending it undecimated");
+            factor = 1;
+        }
+
+        for (const OutputGroup& group : groups)
+        {
+            StreamOutput* output = new StreamOutput();
+
+            output->streamId = stream->getStreamId();
+            output->name = group.name.toStdString();
+            output->sendTopic = sendsTopics();
+
+            output->sampleRate = sampleRate / factor;
+            output->decimator.reset(factor, group.channels.size(), blockSamples);
+            output->decimated.reserve(size_t(group.channels.size()) * (blockSamples / factor + 1));
+
+            for (auto chan : group.channels)
+            {
+                ContinuousChannel* channel = stream->getContinuousChannels()[chan];
+
+                output->globalChannels.add(channel->getGlobalIndex());
+                output->bitVolts.push_back(channel->getBitVolts());
+            }
+
+            // Sized once here, so that process() does not allocate
+            output->eventCodes.reserve(blockSamples);
+            output->ttlEvents.reserve(RESERVED_TTL_EVENTS);
+
+            maxChannels = jmax(maxChannels, group.channels.size());
+            maxNameLength = jmax(maxNameLength, int(output->name.size()));
+            outputs.add(output);
+        }
+    }
+
+    encoder.reserve(maxChannels, blockSamples, maxNameLength);
+
+    pendingSidePackets.clear();
+    pendingSidePackets.reserve(MAX_PENDING_SIDE_BYTES);
+
+    if ((forwardSpikes || forwardMessages) && transport == ZmqTransport::SHARED_MEMORY)
+        LOGC("Falcon Output does not forward spikes or messages over shared memory; use a ZeroMQ transport for them");
+    spikeThresholds.reserve(64);
+
+    if (asyncMode)
+    {
+        if (!socket && !sharedMemory.isOpen())
+            createSocket();
+
+        sendRing.reset(ASYNC_RING_SLOTS, maxChannels, blockSamples, RESERVED_TTL_EVENTS, MAX_PENDING_SIDE_BYTES);
+        droppedBlocks = 0;
+        senderThread->startThread();
+    }
 
     return true;
 }
 
-void FalconOutput::parameterValueChanged(Parameter* param)
+bool FalconOutput::stopAcquisition()
 {
-    if (param->getName().equalsIgnoreCase("Channels"))
-    {   
-        if(param->getStreamId() == selectedStream)
-            selectedChannels = static_cast<MaskChannelsParameter*>(param)->getArrayValue();
+    if (senderThread->isThreadRunning())
+    {
+        senderThread->signalThreadShouldExit();
+        senderThread->notify();
+        senderThread->stopThread(1000);
     }
-    else if (param->getName().equalsIgnoreCase("data_port"))
+
+    if (latencyCsv)
+        writeLatencyCsv();
+
+    return true;
+}
+
+void FalconOutput::writeLatencyCsv()
+{
+    File file = CoreServices::getRecordingParentDirectory()
+                    .getChildFile("falcon_output_latency_" + Time::getCurrentTime().formatted("%Y-%m-%d_%H-%M-%S") + ".csv");
+
+    String csv(LatencyHistogram::getCsvHeader());
+    csv += encodeLatency.getCsvRows("encode");
+    csv += sendLatency.getCsvRows("send");
+
+    if (file.replaceWithText(csv))
+        LOGC("Falcon Output latency histograms written to ", file.getFullPathName());
+    else
+        LOGE("Couldn't write ", file.getFullPathName());
+}
+
+void FalconOutput::parameterValueChanged(Parameter* param)
+{
+    if (param->getName().equalsIgnoreCase("data_port"))
     {
         int dataPort = static_cast<IntParameter*>(param)->getIntValue();
         setPort(dataPort);
     }
+    else if (param->getName().equalsIgnoreCase("transport"))
+    {
+        transport = static_cast<CategoricalParameter*>(param)->getSelectedIndex();
+        closeSocket();
+        createSocket();
+    }
+    else if (param->getName().equalsIgnoreCase("ipc_path"))
+    {
+        ipcPath = param->getValueAsString().toStdString();
+
+        if (transport == ZmqTransport::IPC)
+        {
+            closeSocket();
+            createSocket();
+        }
+    }
+    else if (param->getName().equalsIgnoreCase("zero_copy"))
+    {
+        zeroCopy = static_cast<BooleanParameter*>(param)->getBoolValue();
+    }
+    else if (param->getName().equalsIgnoreCase("sample_format"))
+    {
+        sampleFormat = static_cast<CategoricalParameter*>(param)->getSelectedIndex();
+    }
+    else if (param->getName().equalsIgnoreCase("compression"))
+    {
+        compression = static_cast<CategoricalParameter*>(param)->getSelectedIndex();
+    }
+    else if (param->getName().equalsIgnoreCase("sample_major"))
+    {
+        sampleMajor = static_cast<BooleanParameter*>(param)->getBoolValue();
+    }
+    else if (param->getName().equalsIgnoreCase("async_send"))
+    {
+        asyncMode = static_cast<BooleanParameter*>(param)->getBoolValue();
+    }
+    else if (param->getName().equalsIgnoreCase("multi_stream"))
+    {
+        multiStream = static_cast<BooleanParameter*>(param)->getBoolValue();
+
+        if (socketOptions.conflate)
+        {
+            closeSocket();
+            createSocket();
+        }
+    }
+    else if (param->getName().equalsIgnoreCase("groups"))
+    {
+        // Groups add topic frames, which conflation cannot carry
+        if (socketOptions.conflate)
+        {
+            closeSocket();
+            createSocket();
+        }
+    }
+    else if (param->getName().equalsIgnoreCase("io_threads"))
+    {
+        socketOptions.ioThreads = static_cast<IntParameter*>(param)->getIntValue();
+
+        // The number of I/O threads can only be set before the context has sockets
+        closeSocket();
+        zmq_ctx_destroy(context);
+        context = ZmqTransport::createContext(socketOptions);
+        createSocket();
+    }
+    else if (param->getName().equalsIgnoreCase("send_hwm")
+             || param->getName().equalsIgnoreCase("send_buffer")
+             || param->getName().equalsIgnoreCase("affinity")
+             || param->getName().equalsIgnoreCase("conflate")
+             || param->getName().equalsIgnoreCase("tcp_keepalive"))
+    {
+        socketOptions.highWaterMark = static_cast<IntParameter*>(getParameter("send_hwm"))->getIntValue();
+        socketOptions.bufferSize = static_cast<IntParameter*>(getParameter("send_buffer"))->getIntValue();
+        socketOptions.affinity = uint64(static_cast<IntParameter*>(getParameter("affinity"))->getIntValue());
+        socketOptions.conflate = static_cast<BooleanParameter*>(getParameter("conflate"))->getBoolValue();
+        socketOptions.tcpKeepalive = static_cast<BooleanParameter*>(getParameter("tcp_keepalive"))->getBoolValue();
+
+        closeSocket();
+        createSocket();
+    }
+    else if (param->getName().equalsIgnoreCase("forward_spikes"))
+    {
+        forwardSpikes = static_cast<BooleanParameter*>(param)->getBoolValue();
+
+        // Spikes are sent after a topic frame, which conflation cannot carry
+        if (socketOptions.conflate)
+        {
+            closeSocket();
+            createSocket();
+        }
+    }
+    else if (param->getName().equalsIgnoreCase("forward_messages"))
+    {
+        forwardMessages = static_cast<BooleanParameter*>(param)->getBoolValue();
+
+        if (socketOptions.conflate)
+        {
+            closeSocket();
+            createSocket();
+        }
+    }
+    else if (param->getName().equalsIgnoreCase("event_format"))
+    {
+        eventFormat = static_cast<CategoricalParameter*>(param)->getSelectedIndex();
+    }
+    else if (param->getName().equalsIgnoreCase("timestamp_clock"))
+    {
+        timestampClock = static_cast<CategoricalParameter*>(param)->getSelectedIndex();
+
+        if (!HostClock::isAvailable(HostClock::Type(timestampClock)))
+        {
+            LOGC("Falcon Output: ", param->getValueAsString(), " clock not available on this platform, using steady");
+            timestampClock = HostClock::STEADY;
+        }
+    }
+    else if (param->getName().equalsIgnoreCase("hardware_timestamp"))
+    {
+        hardwareTimestamps = static_cast<BooleanParameter*>(param)->getBoolValue();
+    }
+    else if (param->getName().equalsIgnoreCase("latency_csv"))
+    {
+        latencyCsv = static_cast<BooleanParameter*>(param)->getBoolValue();
+    }
 }
 
 void FalconOutput::setSelectedStream(int idx)
 {
     selectedStream = idx;
-    
-    // Set the selected channels for the selected stream
-    if (selectedStream > 0)
-        parameterValueChanged(getDataStream(selectedStream)->getParameter("Channels"));
 }
 
 void FalconOutput::setPort(uint32_t new_port)
@@ -35,15 +35,93 @@
 #include <errno.h>
 
 #include "FalconOutputEditor.h"
-#include "flatbuffers/flatbuffers.h"
-#include "channel_generated.h"
+#include "Decimator.h"
+#include "SampleBlockRing.h"
+#include "SharedMemoryRing.h"
+#include "LatencyHistogram.h"
+#include "PacketCodec.h"
+#include "ZmqTransport.h"
 
 #define MAX_NUM_CHANNELS 5000
+#define ASYNC_RING_SLOTS 32
+#define SHM_RING_SLOTS 16
+#define SHM_INITIAL_SLOT_SIZE (1 << 20)
+#define RESERVED_BLOCK_SAMPLES 1024     // Block size preallocated when the audio block size is not known yet
+#define RESERVED_TTL_EVENTS 256         // TTL changes per block preallocated in sparse event mode
+#define MAX_PENDING_SIDE_BYTES (1 << 20) // Spike and message packets held for the sender; newer ones are dropped beyond this
+
+class FalconOutput;
+
+/** A named subset of the channels of a stream, published as its own output */
+struct OutputGroup
+{
+    String name;
+    Array<int> channels;            // Indices within the stream
+};
+
+/** Sending state of one data stream, or of one output group of a stream */
+struct StreamOutput
+{
+    uint16 streamId;
+    std::string name;               // Stream or group name, also used as the ZMQ topic
+    bool sendTopic = false;         // Precede each packet by a topic frame (multi-stream mode and groups)
+    int sampleRate;
+
+    Array<int> globalChannels;      // Buffer indices of the channels to send
+    std::vector<float> bitVolts;
+
+    std::vector<uint16> eventCodes;
+    uint16 lastEventCode = 0;
+    int64 lastEventIndex = 0;
+
+    // Sparse event mode: state of lines 0-63, at the start of the block and now, and the changes in the block
+    uint64 blockTtlWord = 0;
+    uint64 ttlWord = 0;
+    std::vector<openephysflatbuffer::TtlEvent> ttlEvents;
+
+    uint64 messageNumber = 0;
+
+    // Decimation: packets carry the filtered samples, numbered and rated in the decimated stream,
+    // and the TTL changes delayed like them (delayedTtlWord is the state sent before the next packet)
+    Decimator decimator;
+    uint64 delayedTtlWord = 0;
+    std::vector<float> decimated;
+};
+
+/** Encodes and sends the blocks queued by FalconOutput::process() in asynchronous mode */
+class FalconSenderThread : public Thread
+{
+public:
+
+    /** Constructor */
+    FalconSenderThread(FalconOutput* processor);
+
+    /** Sends queued blocks until asked to exit, then drains the queue */
+    void run() override;
+
+private:
+
+    FalconOutput* processor;
+};
 
 class FalconOutput: public GenericProcessor
 {
 public:
 
+    /** Encodings of the samples in a packet (indices of the sample_format parameter) */
+    enum SampleFormat
+    {
+        FLOAT32 = 0,
+        INT16
+    };
+
+    /** Encodings of the TTL events (indices of the event_format parameter) */
+    enum EventFormat
+    {
+        PER_SAMPLE_EVENTS = 0,
+        SPARSE_EVENTS
+    };
+
     /** Constructor */
     FalconOutput();
 
@@ -56,6 +134,12 @@ public:
     /** Updates event codes in response to incoming events */
     void handleTTLEvent(TTLEventPtr event) override;
 
+    /** Publishes incoming spikes on the spike topic, if enabled */
+    void handleSpike(SpikePtr spike) override;
+
+    /** Publishes broadcast messages on the message topic, if enabled */
+    void handleBroadcastMessage(String msg) override;
+
     /** Called whenever the settings of upstream plugins have changed */
     void updateSettings() override;
 
@@ -65,21 +149,68 @@ public:
     /** Called at start of acquisition*/
     bool startAcquisition() override;
 
+    /** Called at end of acquisition*/
+    bool stopAcquisition() override;
+
     AudioProcessorEditor* createEditor();
 
     /** Updates the output stream*/
 	void setSelectedStream(int idx);
 
+    /** True if all enabled streams are sent, each under its own topic */
+    bool isMultiStream() const { return multiStream; }
+
+    /** True if packets are encoded and sent on a separate thread */
+    bool isAsync() const { return asyncMode; }
+
+    /** Number of blocks waiting for the sender thread */
+    int getQueuedBlocks() const { return sendRing.getNumReady(); }
+
+    /** Number of blocks the queue can hold */
+    int getQueueCapacity() const { return sendRing.getCapacity(); }
+
+    /** Number of blocks discarded because the queue was full */
+    int64 getDroppedBlocks() const { return droppedBlocks.load(); }
+
+    /** Time spent encoding each packet */
+    const LatencyHistogram& getEncodeLatency() const { return encodeLatency; }
+
+    /** Time spent handing each packet to the transport */
+    const LatencyHistogram& getSendLatency() const { return sendLatency; }
+
+    /** Advanced settings of the publisher socket */
+    const ZmqTransport::SocketOptions& getSocketOptions() const { return socketOptions; }
+
 private:
 
+    friend class FalconSenderThread;
+
+    /** Encodes and sends every block currently in the queue (sender thread) */
+    void sendQueuedBlocks();
+
     void createSocket();
     void closeSocket();
 
     void setPort(uint32_t new_port);
 
-    void sendData(const float **bufferChanPtrs,
-                  int nChannels, int nSamples,
-                  int64 sampleNumber, double timestamp, int sampleRate);
+    void sendData(StreamOutput& output, const float **bufferChanPtrs,
+                  int nSamples, const PacketEvents& events,
+                  int64 sampleNumber, PacketTimes times);
+
+    /** Moves the packet in sideEncoder to the pending spike/message packets */
+    void queueSidePacket(const char* topic);
+
+    /** Sends spike/message packets queued by queueSidePacket(), each after its topic frame */
+    void sendSidePackets(const std::vector<uint8>& packets);
+
+    /** Parses the groups parameter, e.g. "ripple: 1-4, 9; monitor: 33"; channels are 1-based and must be below numChannels */
+    static std::vector<OutputGroup> parseGroups(const String& spec, int numChannels);
+
+    /** True if packets are preceded by topic frames (multi-stream mode or output groups) */
+    bool sendsTopics();
+
+    /** Writes the latency histograms next to the recordings */
+    void writeLatencyCsv();
 
     void *context;
     void *socket;
@@ -87,17 +218,44 @@ private:
     uint16 selectedStream;
 
     int flag;
-    int messageNumber;
+    bool zeroCopy;
+    bool sampleMajor;
+    int sampleFormat;
+    int compression;
+    int eventFormat;
+    bool asyncMode;
+    bool multiStream;
+    bool latencyCsv;
+    bool forwardSpikes;
+    bool forwardMessages;
+    int timestampClock;             // HostClock::Type, STEADY if the selected clock is not available
+    bool hardwareTimestamps;
     uint32_t port;
-    flatbuffers::FlatBufferBuilder flatBuilder;
+    int transport;
+    std::string ipcPath;
+    ZmqTransport::SocketOptions socketOptions;
+    SharedMemoryRing sharedMemory;
+    PacketEncoder encoder;
 
-    Array<int> selectedChannels;
-    std::vector<uint16> eventCodes;
-    uint16 lastEventCode;
-    int64 lastEventIndex;
+    // Spikes and messages are encoded on the audio thread while the sender thread may be using encoder
+    PacketEncoder sideEncoder;
+    std::vector<uint8> pendingSidePackets;
+    std::vector<float> spikeThresholds;
+    uint64 spikeMessageNumber = 0;
+    uint64 textMessageNumber = 0;
+
+    OwnedArray<StreamOutput> outputs;
 
     const float* bufferPtrs[MAX_NUM_CHANNELS];
 
+    SampleBlockRing sendRing;
+    std::unique_ptr<FalconSenderThread> senderThread;
+    std::atomic<int64> droppedBlocks;
+    const float* senderPtrs[MAX_NUM_CHANNELS];
+
+    LatencyHistogram encodeLatency;
+    LatencyHistogram sendLatency;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(FalconOutput);
 
 };
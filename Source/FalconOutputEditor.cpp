@@ -25,17 +25,18 @@
 
 #include "FalconOutputEditor.h"
 #include "FalconOutput.h"
+#include "SocketOptionsPanel.h"
 
 
 FalconOutputEditor::FalconOutputEditor(GenericProcessor *parentNode): GenericEditor(parentNode)
 {
     falconProcessor = (FalconOutput*)parentNode;
 
-    desiredWidth = 200;
+    desiredWidth = 1010;
 
 	streamSelection = std::make_unique<ComboBox>("Stream Selector");
     streamSelection->setBounds(30, 40, 140, 20);
-    streamSelection->setTooltip("Output stream");
+    streamSelection->setTooltip("Output stream (all enabled streams are sent in multi-stream mode)");
     streamSelection->addListener(this);
     addAndMakeVisible(streamSelection.get());
 
@@ -43,6 +44,58 @@ FalconOutputEditor::FalconOutputEditor(GenericProcessor *parentNode): GenericEdi
 
     addTextBoxParameterEditor("data_port", 110, 70);
 
+    addToggleParameterEditor("zero_copy", 200, 30);
+
+    addToggleParameterEditor("async_send", 200, 70);
+
+    addToggleParameterEditor("sample_major", 290, 30);
+
+    addComboBoxParameterEditor("sample_format", 290, 70);
+
+    addComboBoxParameterEditor("compression", 380, 30);
+
+    addToggleParameterEditor("multi_stream", 380, 70);
+
+    addComboBoxParameterEditor("transport", 470, 30);
+
+    addTextBoxParameterEditor("ipc_path", 470, 70);
+
+    addToggleParameterEditor("latency_csv", 560, 30);
+
+    addComboBoxParameterEditor("event_format", 650, 30);
+
+    addToggleParameterEditor("forward_spikes", 650, 70);
+
+    addToggleParameterEditor("forward_messages", 740, 30);
+
+    addComboBoxParameterEditor("decimation", 740, 70);
+
+    addTextBoxParameterEditor("groups", 830, 30);
+
+    addComboBoxParameterEditor("timestamp_clock", 830, 70);
+
+    addToggleParameterEditor("hardware_timestamp", 920, 30);
+
+    socketButton = std::make_unique<UtilityButton>("socket", Font("Small Text", 12, Font::plain));
+    socketButton->setBounds(565, 80, 70, 20);
+    socketButton->setTooltip("Advanced ZeroMQ settings: high water mark, buffers, I/O threads, affinity, conflate, keepalive");
+    socketButton->addListener(this);
+    addAndMakeVisible(socketButton.get());
+
+    queueStatus = std::make_unique<Label>("Queue Status", "");
+    queueStatus->setFont(Font("Small Text", 10, Font::plain));
+    queueStatus->setBounds(195, 108, 100, 15);
+    queueStatus->setColour(Label::textColourId, Colours::darkgrey);
+    queueStatus->setTooltip("Blocks queued for the sender thread / blocks dropped");
+    addAndMakeVisible(queueStatus.get());
+
+    latencyStatus = std::make_unique<Label>("Latency Status", "");
+    latencyStatus->setFont(Font("Small Text", 10, Font::plain));
+    latencyStatus->setBounds(290, 108, 270, 15);
+    latencyStatus->setColour(Label::textColourId, Colours::darkgrey);
+    latencyStatus->setTooltip("Encode and send times per packet: p50/p99/p99.9/max in microseconds");
+    addAndMakeVisible(latencyStatus.get());
+
 }
 
 FalconOutputEditor::~FalconOutputEditor()
@@ -50,6 +103,34 @@ FalconOutputEditor::~FalconOutputEditor()
 
 }
 
+void FalconOutputEditor::buttonClicked(Button* button)
+{
+    if (button == socketButton.get())
+    {
+        auto panel = std::make_unique<SocketOptionsPanel>(falconProcessor->getSocketOptions(), true,
+            [this](const ZmqTransport::SocketOptions& options)
+            {
+                setSocketParameter("send_hwm", options.highWaterMark);
+                setSocketParameter("send_buffer", options.bufferSize);
+                setSocketParameter("io_threads", options.ioThreads);
+                setSocketParameter("affinity", int(options.affinity));
+                setSocketParameter("conflate", options.conflate);
+                setSocketParameter("tcp_keepalive", options.tcpKeepalive);
+            });
+
+        CallOutBox::launchAsynchronously(std::move(panel), socketButton->getScreenBounds(), nullptr);
+    }
+}
+
+void FalconOutputEditor::setSocketParameter(const String& name, var value)
+{
+    Parameter* param = falconProcessor->getParameter(name);
+
+    // Only the changed setting, so the socket is recreated once per edit
+    if (param != nullptr && param->getValue() != value)
+        param->setNextValue(value);
+}
+
 void FalconOutputEditor::comboBoxChanged(ComboBox* cb)
 {
     if (cb == streamSelection.get())
@@ -61,12 +142,36 @@ void FalconOutputEditor::comboBoxChanged(ComboBox* cb)
 void FalconOutputEditor::startAcquisition()
 {
 	streamSelection->setEnabled(false);
+    socketButton->setEnabled(false);
+
+    queueStatus->setText("", dontSendNotification);
+    startTimer(200);
 }
 
 
 void FalconOutputEditor::stopAcquisition()
 {
 	streamSelection->setEnabled(true);
+    socketButton->setEnabled(true);
+
+    stopTimer();
+    timerCallback();
+}
+
+
+void FalconOutputEditor::timerCallback()
+{
+    if (falconProcessor->isAsync())
+    {
+        queueStatus->setText("Queue " + String(falconProcessor->getQueuedBlocks())
+                             + "/" + String(falconProcessor->getQueueCapacity())
+                             + ", dropped " + String(falconProcessor->getDroppedBlocks()),
+                             dontSendNotification);
+    }
+
+    latencyStatus->setText("Encode " + String(falconProcessor->getEncodeLatency().getSummary())
+                           + "  Send " + String(falconProcessor->getSendLatency().getSummary()) + " us",
+                           dontSendNotification);
 }
 
 
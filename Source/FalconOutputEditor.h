@@ -32,7 +32,9 @@ class FalconOutput;
 struct StreamApplication;
 
 class FalconOutputEditor: public GenericEditor,
-                          public ComboBox::Listener
+                          public ComboBox::Listener,
+                          public Button::Listener,
+                          public Timer
 {
 public:
 
@@ -40,6 +42,9 @@ public:
 
     virtual ~FalconOutputEditor();
 
+    /** Opens the socket settings panel */
+    void buttonClicked(Button* button) override;
+
     /** Sets the output stream */
     void comboBoxChanged(ComboBox *cb) override;
 
@@ -50,6 +55,9 @@ public:
     /** Updates available streams*/
 	void updateStreamSelectorOptions();
 
+    /** Refreshes the sender queue and latency statistics */
+    void timerCallback() override;
+
 
 private:
 
@@ -57,9 +65,18 @@ private:
 
     std::unique_ptr<ComboBox> streamSelection;
 
+    std::unique_ptr<Label> queueStatus;
+
+    std::unique_ptr<Label> latencyStatus;
+
+    std::unique_ptr<UtilityButton> socketButton;
+
     Array<int> inputStreamIds;
 
     void setOutputStream(int index);
+
+    /** Sets a parameter edited in the socket panel, if it changed */
+    void setSocketParameter(const String& name, var value);
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FalconOutputEditor)
 
@@ -0,0 +1,78 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "HostClock.h"
+
+#include <chrono>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <time.h>
+#endif
+
+namespace
+{
+#if defined(__linux__) || defined(__APPLE__)
+    inline uint64_t readClock(clockid_t id)
+    {
+        timespec now;
+        clock_gettime(id, &now);
+
+        return uint64_t(now.tv_sec) * 1000000000ull + uint64_t(now.tv_nsec);
+    }
+#endif
+}
+
+bool HostClock::isAvailable(Type type)
+{
+    switch (type)
+    {
+#ifdef CLOCK_MONOTONIC_RAW
+        case MONOTONIC_RAW:
+            return true;
+#endif
+#ifdef CLOCK_TAI
+        case TAI:
+            return true;
+#endif
+        case STEADY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+uint64_t HostClock::nowNanoseconds(Type type)
+{
+#ifdef CLOCK_MONOTONIC_RAW
+    if (type == MONOTONIC_RAW)
+        return readClock(CLOCK_MONOTONIC_RAW);
+#endif
+#ifdef CLOCK_TAI
+    if (type == TAI)
+        return readClock(CLOCK_TAI);
+#endif
+
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
@@ -0,0 +1,50 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef HOSTCLOCK_H_INCLUDED
+#define HOSTCLOCK_H_INCLUDED
+
+#include <cstdint>
+
+/**
+    Nanosecond reads of the host clocks that Falcon Output can stamp packets with.
+    The values of Type match openephysflatbuffer::TimestampClock.
+*/
+namespace HostClock
+{
+    enum Type
+    {
+        STEADY = 0,         // std::chrono::steady_clock, available everywhere
+        MONOTONIC_RAW,      // Linux and macOS
+        TAI                 // Linux; equal to CLOCK_REALTIME unless the kernel's TAI offset is set (by PTP or NTP)
+    };
+
+    /** False if the clock cannot be read on this platform */
+    bool isAvailable(Type type);
+
+    /** Current time of a clock in nanoseconds, or of the steady clock if it is not available */
+    uint64_t nowNanoseconds(Type type);
+}
+
+#endif  // HOSTCLOCK_H_INCLUDED
@@ -0,0 +1,180 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "LatencyHistogram.h"
+
+#include <cstdio>
+
+namespace
+{
+    inline int highestBit(uint64_t value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(value);
+#else
+        int bit = 0;
+
+        while (value >>= 1)
+            bit++;
+
+        return bit;
+#endif
+    }
+
+    std::string formatMicroseconds(double value)
+    {
+        char text[32];
+        std::snprintf(text, sizeof(text), value < 10.0 ? "%.1f" : "%.0f", value);
+        return text;
+    }
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+int LatencyHistogram::getBucket(uint64_t nanoseconds)
+{
+    if (nanoseconds < 2 * SUB_BUCKETS)
+        return int(nanoseconds);
+
+    // The top SUB_BUCKET_BITS + 1 bits select the bucket
+    const int shift = highestBit(nanoseconds) - SUB_BUCKET_BITS;
+    const int bucket = shift * SUB_BUCKETS + int(nanoseconds >> shift);
+
+    return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::getBucketLowerBound(int bucket)
+{
+    if (bucket < 2 * SUB_BUCKETS)
+        return uint64_t(bucket);
+
+    const int shift = bucket / SUB_BUCKETS - 1;
+
+    return uint64_t(bucket - shift * SUB_BUCKETS) << shift;
+}
+
+uint64_t LatencyHistogram::getBucketUpperBound(int bucket)
+{
+    return getBucketLowerBound(bucket + 1) - 1;
+}
+
+void LatencyHistogram::record(double microseconds)
+{
+    const uint64_t nanoseconds = microseconds > 0.0 ? uint64_t(microseconds * 1000.0) : 0;
+
+    counts[getBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t previous = maximum.load(std::memory_order_relaxed);
+
+    while (nanoseconds > previous && !maximum.compare_exchange_weak(previous, nanoseconds, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto& count : counts)
+        count.store(0, std::memory_order_relaxed);
+
+    total.store(0, std::memory_order_relaxed);
+    maximum.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getCount() const
+{
+    return total.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::getPercentile(double percentile) const
+{
+    const uint64_t count = getCount();
+
+    if (count == 0)
+        return 0.0;
+
+    // Rank of the value at this percentile, counting from 1
+    uint64_t rank = uint64_t(percentile / 100.0 * double(count) + 0.5);
+    rank = rank < 1 ? 1 : (rank > count ? count : rank);
+
+    uint64_t seen = 0;
+
+    for (int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+    {
+        seen += counts[bucket].load(std::memory_order_relaxed);
+
+        if (seen >= rank)
+        {
+            // Never report more than the largest value actually seen
+            const uint64_t upper = getBucketUpperBound(bucket);
+            const uint64_t largest = maximum.load(std::memory_order_relaxed);
+
+            return double(upper < largest ? upper : largest) / 1000.0;
+        }
+    }
+
+    return getMax();
+}
+
+double LatencyHistogram::getMax() const
+{
+    return double(maximum.load(std::memory_order_relaxed)) / 1000.0;
+}
+
+std::string LatencyHistogram::getSummary() const
+{
+    if (getCount() == 0)
+        return "-";
+
+    return formatMicroseconds(getPercentile(50.0)) + "/" + formatMicroseconds(getPercentile(99.0)) + "/"
+         + formatMicroseconds(getPercentile(99.9)) + "/" + formatMicroseconds(getMax());
+}
+
+const char* LatencyHistogram::getCsvHeader()
+{
+    return "histogram,lower_us,upper_us,count\n";
+}
+
+std::string LatencyHistogram::getCsvRows(const std::string& name) const
+{
+    std::string rows;
+    char line[128];
+
+    for (int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+    {
+        const uint32_t count = counts[bucket].load(std::memory_order_relaxed);
+
+        if (count == 0)
+            continue;
+
+        std::snprintf(line, sizeof(line), ",%.3f,%.3f,%u\n",
+                      double(getBucketLowerBound(bucket)) / 1000.0, double(getBucketUpperBound(bucket)) / 1000.0, count);
+        rows += name + line;
+    }
+
+    return rows;
+}
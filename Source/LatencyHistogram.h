@@ -0,0 +1,87 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef LATENCYHISTOGRAM_H_INCLUDED
+#define LATENCYHISTOGRAM_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+    Log-linear histogram of durations, in the spirit of HdrHistogram.
+
+    Values are recorded in nanoseconds into buckets that split every power of
+    two into SUB_BUCKETS linear steps, so percentiles are within 1/SUB_BUCKETS
+    of the true value from 1 ns to about 4 hours. Recording is wait-free
+    (relaxed atomic increments), so the audio or network thread can record
+    while the message thread reads the percentiles.
+*/
+class LatencyHistogram
+{
+public:
+
+    /** Constructor */
+    LatencyHistogram();
+
+    /** Adds one duration; negative values count as 0 */
+    void record(double microseconds);
+
+    /** Forgets all recorded values; not safe against concurrent record() calls */
+    void reset();
+
+    /** Number of recorded values */
+    uint64_t getCount() const;
+
+    /** Upper bound of the bucket holding the given percentile (0-100), in microseconds */
+    double getPercentile(double percentile) const;
+
+    /** Largest recorded value, in microseconds */
+    double getMax() const;
+
+    /** "p50/p99/p99.9/max" in microseconds, or "-" if nothing was recorded */
+    std::string getSummary() const;
+
+    /** One "name,lower_us,upper_us,count" line per non-empty bucket */
+    std::string getCsvRows(const std::string& name) const;
+
+    /** Header matching getCsvRows() */
+    static const char* getCsvHeader();
+
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int NUM_BUCKETS = 41 * SUB_BUCKETS;
+
+private:
+
+    static int getBucket(uint64_t nanoseconds);
+    static uint64_t getBucketLowerBound(int bucket);
+    static uint64_t getBucketUpperBound(int bucket);
+
+    std::atomic<uint32_t> counts[NUM_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> maximum;
+};
+
+#endif  // LATENCYHISTOGRAM_H_INCLUDED
@@ -0,0 +1,402 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "PacketCodec.h"
+#include "SampleCodec.h"
+#include "SampleTranspose.h"
+
+#include <algorithm>
+#include <cstring>
+
+PacketEncoder::Builder::Builder(size_t size, bool pooled_)
+    : builder(size), pooled(pooled_)
+{
+    // Allocate the storage now, rather than on the first packet
+    builder.PushElement<uint8_t>(0);
+    builder.Clear();
+}
+
+PacketEncoder::PacketEncoder()
+    : reservedSize(1024)
+{
+    pool.reserve(MAX_POOLED_BUILDERS);
+    pool.push_back(std::make_unique<Builder>(reservedSize, true));
+    current = pool.front().get();
+}
+
+PacketEncoder::~PacketEncoder()
+{
+    // A packet can still sit in a transport queue: whichever of this and releasePacket()
+    // clears the held flag second frees the builder
+    for (auto& b : pool)
+    {
+        if (b->held.exchange(false, std::memory_order_acq_rel))
+            b.release();
+    }
+}
+
+void PacketEncoder::reserve(int nChannels, int maxSamples, size_t streamNameLength)
+{
+    const size_t floatSize = size_t(nChannels) * maxSamples * sizeof(float);
+    const size_t compressedSize = SampleCodec::getMaxCompressedSize(nChannels, maxSamples) + nChannels * sizeof(float);
+
+    if (compressBuffer.size() < SampleCodec::getMaxCompressedSize(nChannels, maxSamples))
+        compressBuffer.resize(SampleCodec::getMaxCompressedSize(nChannels, maxSamples));
+
+    // Largest sample vector of any format, plus events, stream name, table and alignment
+    const size_t size = std::max(floatSize, compressedSize) + maxSamples * sizeof(uint16_t) + streamNameLength + 256;
+
+    if (size <= reservedSize)
+        return;
+
+    reservedSize = size;
+
+    // Held builders grow by themselves if they need to, when they come back
+    for (auto& b : pool)
+    {
+        if (!b->held.load(std::memory_order_acquire))
+            b = std::make_unique<Builder>(reservedSize, true);
+    }
+
+    spare.reset();
+    current = acquireBuilder();
+}
+
+PacketEncoder::Builder* PacketEncoder::acquireBuilder()
+{
+    for (auto& b : pool)
+    {
+        if (!b->held.load(std::memory_order_acquire))
+            return b.get();
+    }
+
+    if (int(pool.size()) < MAX_POOLED_BUILDERS)
+    {
+        pool.push_back(std::make_unique<Builder>(reservedSize, true));
+        return pool.back().get();
+    }
+
+    // The transport is far behind: build in an extra builder that is freed once sent
+    if (spare == nullptr)
+        spare = std::make_unique<Builder>(reservedSize, false);
+
+    return spare.get();
+}
+
+void* PacketEncoder::holdPacket()
+{
+    current->held.store(true, std::memory_order_relaxed);
+
+    if (current == spare.get())
+        return spare.release();
+
+    return current;
+}
+
+void PacketEncoder::releasePacket(void*, void* hint)
+{
+    Builder* b = static_cast<Builder*>(hint);
+
+    // Already cleared: the encoder is gone and left the builder to this call
+    if (!b->pooled || !b->held.exchange(false, std::memory_order_acq_rel))
+        delete b;
+}
+
+void PacketEncoder::encode(const PacketFormat& format,
+                           const float* const* channels, int nChannels, int nSamples,
+                           const float* bitVolts, const PacketEvents& events,
+                           const std::string& stream, uint64_t sampleNumber, const PacketTimes& times,
+                           uint64_t messageId, uint32_t sampleRate)
+{
+    current = acquireBuilder();
+
+    flatbuffers::FlatBufferBuilder& builder = current->builder;
+    builder.Clear();
+
+    // Samples are written straight into the builder's storage
+    flatbuffers::Offset<flatbuffers::Vector<float>> samples;
+    flatbuffers::Offset<flatbuffers::Vector<int16_t>> int_samples;
+    flatbuffers::Offset<flatbuffers::Vector<float>> bit_volts;
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> compressed_samples;
+
+    if (format.compressed)
+    {
+        // Always channel-major, so that each channel is coded along time
+        const float* scales = format.int16Samples ? bitVolts : nullptr;
+        const size_t maxSize = SampleCodec::getMaxCompressedSize(nChannels, nSamples);
+
+        if (compressBuffer.size() < maxSize)
+            compressBuffer.resize(maxSize);
+
+        size_t size = SampleCodec::compress(channels, nChannels, nSamples, scales, compressBuffer.data());
+        compressed_samples = builder.CreateVector(compressBuffer.data(), size);
+
+        if (scales != nullptr)
+            bit_volts = builder.CreateVector(scales, nChannels);
+    }
+    else if (format.int16Samples)
+    {
+        int16_t* flatcounts;
+        int_samples = builder.CreateUninitializedVector<int16_t>(size_t(nChannels) * nSamples, &flatcounts);
+
+        for (int ch = 0; ch < nChannels; ch++)
+        {
+            if (format.sampleMajor)
+                SampleCodec::quantizeStrided(channels[ch], nSamples, bitVolts[ch], flatcounts + ch, nChannels);
+            else
+                SampleCodec::quantize(channels[ch], nSamples, bitVolts[ch], flatcounts + size_t(ch) * nSamples);
+        }
+
+        bit_volts = builder.CreateVector(bitVolts, nChannels);
+    }
+    else
+    {
+        float* flatsamples;
+        samples = builder.CreateUninitializedVector<float>(size_t(nChannels) * nSamples, &flatsamples);
+
+        if (format.sampleMajor)
+        {
+            SampleTranspose::interleave(channels, nChannels, nSamples, flatsamples, nChannels);
+        }
+        else
+        {
+            for (int ch = 0; ch < nChannels; ch++)
+                memcpy(flatsamples + size_t(ch) * nSamples, channels[ch], nSamples * sizeof(float));
+        }
+    }
+
+    // Sparse events are only written when a line changed; the per-sample codes always are
+    flatbuffers::Offset<flatbuffers::Vector<uint16_t>> event_codes;
+    flatbuffers::Offset<flatbuffers::Vector<const openephysflatbuffer::TtlEvent*>> ttl_events;
+
+    if (events.codes != nullptr)
+        event_codes = builder.CreateVector(events.codes, nSamples);
+    else if (events.numTtlEvents > 0)
+        ttl_events = builder.CreateVectorOfStructs(events.ttlEvents, events.numTtlEvents);
+
+    auto streamName = builder.CreateString(stream);
+
+    auto packet = openephysflatbuffer::CreateContinuousData(builder, samples, event_codes, streamName,
+                                                            nChannels, nSamples, sampleNumber, times.timestamp,
+                                                            messageId, sampleRate,
+                                                            format.sampleMajor && !format.compressed
+                                                                ? openephysflatbuffer::SampleLayout_SampleMajor
+                                                                : openephysflatbuffer::SampleLayout_ChannelMajor,
+                                                            int_samples, bit_volts,
+                                                            format.compressed ? openephysflatbuffer::Compression_DeltaBitPack
+                                                                              : openephysflatbuffer::Compression_None,
+                                                            compressed_samples,
+                                                            events.codes != nullptr ? 0 : events.ttlWord, ttl_events,
+                                                            times.clock, times.timestampNs, times.enqueuedNs,
+                                                            times.sentNs, times.hardwareTimestamp, times.lastSampleAge);
+    builder.Finish(packet);
+}
+
+void PacketEncoder::encodeSpike(const char* stream, const char* electrode,
+                                const float* waveform, int nChannels, int nSamples, const float* thresholds,
+                                uint16_t sortedId, uint64_t sampleNumber, double timestamp,
+                                uint64_t messageId, uint32_t sampleRate)
+{
+    current = acquireBuilder();
+
+    flatbuffers::FlatBufferBuilder& builder = current->builder;
+    builder.Clear();
+
+    auto samples = builder.CreateVector(waveform, size_t(nChannels) * nSamples);
+    auto levels = builder.CreateVector(thresholds, nChannels);
+    auto streamName = builder.CreateString(stream);
+    auto electrodeName = builder.CreateString(electrode);
+
+    builder.Finish(openephysflatbuffer::CreateSpikeData(builder, streamName, electrodeName, sampleNumber, timestamp,
+                                                        messageId, sampleRate, sortedId, nChannels, nSamples,
+                                                        samples, levels));
+}
+
+void PacketEncoder::encodeText(const char* text, double timestamp, uint64_t messageId)
+{
+    current = acquireBuilder();
+
+    flatbuffers::FlatBufferBuilder& builder = current->builder;
+    builder.Clear();
+
+    auto message = builder.CreateString(text);
+
+    builder.Finish(openephysflatbuffer::CreateTextData(builder, message, timestamp, messageId));
+}
+
+const float* PacketDecoder::getSamples(const openephysflatbuffer::ContinuousData* data, float* dst, int dstChannels,
+                                       int& packetChannels)
+{
+    const int numSamples = data->n_samples();
+    const bool sampleMajor = data->layout() == openephysflatbuffer::SampleLayout_SampleMajor;
+    const flatbuffers::Vector<float>* bitVolts = data->bit_volts();
+
+    packetChannels = 0;
+
+    if (numSamples == 0)
+        return nullptr;
+
+    if (data->compression() == openephysflatbuffer::Compression_DeltaBitPack)
+    {
+        const flatbuffers::Vector<uint8_t>* packed = data->compressed_samples();
+
+        if (packed == nullptr || (bitVolts != nullptr && bitVolts->size() < data->n_channels()))
+            return nullptr;
+
+        const size_t size = size_t(data->n_channels()) * numSamples;
+
+        if (decodeBuffer.size() < size)
+            decodeBuffer.resize(size);
+
+        if (!SampleCodec::decompress(packed->data(), packed->size(), data->n_channels(), numSamples,
+                                     bitVolts != nullptr ? bitVolts->data() : nullptr, decodeBuffer.data()))
+            return nullptr;
+
+        packetChannels = data->n_channels();
+        return decodeBuffer.data();
+    }
+
+    if (const flatbuffers::Vector<int16_t>* counts = data->int_samples())
+    {
+        // Rescale the ADC counts, straight into the output when the layouts match
+        if (bitVolts == nullptr || bitVolts->size() < counts->size() / numSamples)
+            return nullptr;
+
+        packetChannels = int(counts->size() / numSamples);
+
+        float* decoded = dst;
+
+        if (!sampleMajor || packetChannels != dstChannels)
+        {
+            if (decodeBuffer.size() < counts->size())
+                decodeBuffer.resize(counts->size());
+
+            decoded = decodeBuffer.data();
+        }
+
+        if (sampleMajor)
+        {
+            SampleCodec::dequantizeInterleaved(counts->data(), packetChannels, numSamples, bitVolts->data(), decoded);
+        }
+        else
+        {
+            for (int ch = 0; ch < packetChannels; ch++)
+                SampleCodec::dequantize(counts->data() + size_t(ch) * numSamples, numSamples, bitVolts->Get(ch),
+                                        decoded + size_t(ch) * numSamples);
+        }
+
+        return decoded;
+    }
+
+    if (const flatbuffers::Vector<float>* values = data->samples())
+    {
+        packetChannels = int(values->size() / numSamples);
+        return values->data();
+    }
+
+    return nullptr;
+}
+
+void PacketDecoder::decodeEvents(const openephysflatbuffer::ContinuousData* data, uint64_t* dst)
+{
+    const int numSamples = data->n_samples();
+    int i = 0;
+
+    if (const flatbuffers::Vector<uint16_t>* codes = data->event_codes())
+    {
+        const int numCodes = std::min(numSamples, int(codes->size()));
+
+        for (; i < numCodes; i++)
+            dst[i] = codes->Get(i);
+
+        std::fill(dst + i, dst + numSamples, i > 0 ? dst[i - 1] : 0);
+        return;
+    }
+
+    uint64_t word = data->ttl_word();
+
+    if (const flatbuffers::Vector<const openephysflatbuffer::TtlEvent*>* events = data->ttl_events())
+    {
+        for (const openephysflatbuffer::TtlEvent* event : *events)
+        {
+            if (event->line() > 63)
+                continue;
+
+            const int offset = int(std::min(event->sample_offset(), uint32_t(numSamples)));
+
+            for (; i < offset; i++)
+                dst[i] = word;
+
+            const uint64_t bit = uint64_t(1) << event->line();
+            word = event->state() ? word | bit : word & ~bit;
+        }
+    }
+
+    std::fill(dst + i, dst + numSamples, word);
+}
+
+int PacketDecoder::decode(const openephysflatbuffer::ContinuousData* data, float* dst, int dstChannels)
+{
+    const int numSamples = data->n_samples();
+    const bool sampleMajor = data->layout() == openephysflatbuffer::SampleLayout_SampleMajor
+                             && data->compression() == openephysflatbuffer::Compression_None;
+
+    int packetChannels;
+    const float* d = getSamples(data, dst, dstChannels, packetChannels);
+
+    // Channels present in the packet; any missing channels are zero-filled
+    const int receivedChannels = std::min(dstChannels, packetChannels);
+
+    if (d != nullptr && sampleMajor)
+    {
+        if (packetChannels == dstChannels)
+        {
+            if (d != dst)
+                memcpy(dst, d, sizeof(float) * dstChannels * numSamples);
+        }
+        else
+        {
+            for (int i = 0; i < numSamples; i++)
+                memcpy(dst + size_t(dstChannels) * i, d + size_t(packetChannels) * i, sizeof(float) * receivedChannels);
+        }
+    }
+    else if (d != nullptr)
+    {
+        if (int(channelPtrs.size()) < receivedChannels)
+            channelPtrs.resize(receivedChannels);
+
+        for (int ch = 0; ch < receivedChannels; ch++)
+            channelPtrs[ch] = d + size_t(ch) * numSamples;
+
+        SampleTranspose::interleave(channelPtrs.data(), receivedChannels, numSamples, dst, dstChannels);
+    }
+
+    if (receivedChannels < dstChannels)
+    {
+        for (int i = 0; i < numSamples; i++)
+            std::fill(dst + size_t(dstChannels) * i + receivedChannels, dst + size_t(dstChannels) * (i + 1), 0.0f);
+    }
+
+    return receivedChannels;
+}
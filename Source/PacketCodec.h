@@ -0,0 +1,178 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef PACKETCODEC_H_INCLUDED
+#define PACKETCODEC_H_INCLUDED
+
+#include "channel_generated.h"
+#include "flatbuffers/flatbuffers.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** Sample options of the packets built by PacketEncoder */
+struct PacketFormat
+{
+    bool sampleMajor = false;   // interleave channels (ignored when compressed)
+    bool int16Samples = false;  // send ADC counts and bit_volts instead of floats
+    bool compressed = false;    // delta/bit-pack the samples
+};
+
+/** TTL events of a block: one code per sample, or the sparse changes of up to 64 lines */
+struct PacketEvents
+{
+    const uint16_t* codes = nullptr;    // state of lines 0-15 at every sample; nullptr to send the sparse form
+    uint64_t ttlWord = 0;               // state of lines 0-63 before the first sample
+    const openephysflatbuffer::TtlEvent* ttlEvents = nullptr;
+    int numTtlEvents = 0;
+};
+
+/** Timestamps of a block, see the latency fields of ContinuousData */
+struct PacketTimes
+{
+    double timestamp = 0.0;             // seconds of the steady clock, when the block reached Falcon Output
+    openephysflatbuffer::TimestampClock clock = openephysflatbuffer::TimestampClock_Steady;
+    uint64_t timestampNs = 0;           // same instant, in nanoseconds of clock
+    uint64_t enqueuedNs = 0;            // block handed to the sender thread
+    uint64_t sentNs = 0;                // block encoded; the sender overwrites it just before sending
+    double hardwareTimestamp = -1.0;    // upstream timestamp of the first sample, -1 if unknown
+    double lastSampleAge = 0.0;         // seconds from the last sample of the block to timestamp
+};
+
+/**
+    Builds ContinuousData packets from blocks of channel-major samples.
+
+    Packets are built in a small pool of builders whose storage is kept from one
+    packet to the next. Once reserve() has sized them, and as long as the
+    transport hands the packets back, encoding does not allocate.
+
+    Used by Falcon Output and by falcon_bench, so that the benchmark measures
+    the code that runs in the plugin.
+*/
+class PacketEncoder
+{
+public:
+
+    /** Builders kept for packets held by the transport; more are only created while this many are in flight */
+    static const int MAX_POOLED_BUILDERS = 8;
+
+    /** Constructor */
+    PacketEncoder();
+
+    /** Destructor; builders still held by the transport are freed by releasePacket() */
+    ~PacketEncoder();
+
+    /** Allocates the builders and scratch space for blocks of up to nChannels x maxSamples */
+    void reserve(int nChannels, int maxSamples, size_t streamNameLength);
+
+    /**
+        Encodes a block. The finished packet stays in getBuilder() until the next
+        call; the builder may be Clear()ed in between, or handed to the transport
+        with holdPacket().
+    */
+    void encode(const PacketFormat& format,
+                const float* const* channels, int nChannels, int nSamples,
+                const float* bitVolts, const PacketEvents& events,
+                const std::string& stream, uint64_t sampleNumber, const PacketTimes& times,
+                uint64_t messageId, uint32_t sampleRate);
+
+    /** Encodes a SpikeData packet; waveform holds nChannels x nSamples values, channel after channel */
+    void encodeSpike(const char* stream, const char* electrode,
+                     const float* waveform, int nChannels, int nSamples, const float* thresholds,
+                     uint16_t sortedId, uint64_t sampleNumber, double timestamp,
+                     uint64_t messageId, uint32_t sampleRate);
+
+    /** Encodes a TextData packet */
+    void encodeText(const char* text, double timestamp, uint64_t messageId);
+
+    /** Builder holding the last packet */
+    flatbuffers::FlatBufferBuilder& getBuilder() { return current->builder; }
+
+    /**
+        Lends the last packet to the transport without copying it: the next packets
+        are built elsewhere until releasePacket() is called with the returned hint
+        (the signature matches zmq_free_fn).
+    */
+    void* holdPacket();
+
+    /** Gives a packet lent by holdPacket() back to the encoder; may be called from any thread */
+    static void releasePacket(void* data, void* hint);
+
+private:
+
+    struct Builder
+    {
+        Builder(size_t size, bool pooled);
+
+        flatbuffers::FlatBufferBuilder builder;
+        std::atomic<bool> held { false };   // set while lent; exchanged by releasePacket() and the destructor
+        const bool pooled;      // false for a builder created while the whole pool was held; freed on release
+    };
+
+    /** Returns a builder that the transport does not hold */
+    Builder* acquireBuilder();
+
+    std::vector<std::unique_ptr<Builder>> pool;
+    std::unique_ptr<Builder> spare;
+    Builder* current;
+
+    size_t reservedSize;
+    std::vector<uint8_t> compressBuffer;
+};
+
+/**
+    Unpacks the samples of ContinuousData packets, whatever their layout,
+    sample format and compression.
+
+    Used by Falcon Input and by falcon_bench.
+*/
+class PacketDecoder
+{
+public:
+
+    /**
+        Writes the n_samples() samples of a packet to dst, interleaved over
+        dstChannels channels: channels missing from the packet are zero-filled
+        and extra ones are dropped. Returns the number of channels decoded,
+        0 if the packet carries no usable samples.
+    */
+    int decode(const openephysflatbuffer::ContinuousData* data, float* dst, int dstChannels);
+
+    /** Writes the state of the TTL lines at each of the n_samples() samples of a packet to dst, from either event form */
+    void decodeEvents(const openephysflatbuffer::ContinuousData* data, uint64_t* dst);
+
+private:
+
+    /** Returns the samples as floats in the packet's layout (possibly written to dst directly) */
+    const float* getSamples(const openephysflatbuffer::ContinuousData* data, float* dst, int dstChannels,
+                            int& packetChannels);
+
+    std::vector<const float*> channelPtrs;
+    std::vector<float> decodeBuffer;
+};
+
+#endif  // PACKETCODEC_H_INCLUDED
@@ -0,0 +1,151 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SAMPLEBLOCKRING_H_INCLUDED
+#define SAMPLEBLOCKRING_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "PacketCodec.h"
+
+/** One block of samples copied out of the audio thread, in channel-major order */
+struct SampleBlock
+{
+    std::vector<float> samples;
+    std::vector<uint16_t> eventCodes;
+    std::vector<openephysflatbuffer::TtlEvent> ttlEvents;
+    uint64_t ttlWord = 0;
+
+    /** Spike and message packets to send after this block, see FalconOutput::queueSidePacket() */
+    std::vector<uint8_t> sidePackets;
+
+    int output = 0;             // -1 for a slot that only carries sidePackets
+    int numChannels = 0;
+    int numSamples = 0;
+    int64_t sampleNumber = 0;
+    PacketTimes times;
+
+    /** Makes room for a block; only allocates when the block is larger than any seen before */
+    void prepare(int nChannels, int nSamples)
+    {
+        if (samples.size() < size_t(nChannels) * nSamples)
+            samples.resize(size_t(nChannels) * nSamples);
+
+        if (eventCodes.size() < size_t(nSamples))
+            eventCodes.resize(nSamples);
+
+        numChannels = nChannels;
+        numSamples = nSamples;
+    }
+};
+
+/**
+    Lock-free single-producer/single-consumer ring of preallocated SampleBlocks.
+
+    The producer (audio thread) calls beginWrite()/commitWrite(), the consumer
+    (sender thread) calls beginRead()/commitRead(). A slot returned by beginWrite()
+    or beginRead() is owned by that side until it is committed.
+*/
+class SampleBlockRing
+{
+public:
+
+    /** Allocates the slots up front, with room for nTtlEvents TTL changes and nSideBytes of
+        side packets each; must not be called while either side is active */
+    void reset(int numSlots, int nChannels, int nSamples, int nTtlEvents, size_t nSideBytes)
+    {
+        slots.clear();
+        slots.resize(numSlots + 1); // one slot is always kept empty
+
+        for (auto& slot : slots)
+        {
+            slot.prepare(nChannels, nSamples);
+            slot.ttlEvents.reserve(nTtlEvents);
+            slot.sidePackets.reserve(nSideBytes);
+        }
+
+        head.store(0);
+        tail.store(0);
+    }
+
+    /** Returns the next free slot, or nullptr if the ring is full */
+    SampleBlock* beginWrite()
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+
+        if (next(h) == tail.load(std::memory_order_acquire))
+            return nullptr;
+
+        return &slots[h];
+    }
+
+    /** Publishes the slot returned by beginWrite() to the consumer */
+    void commitWrite()
+    {
+        head.store(next(head.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+    /** Returns the oldest filled slot, or nullptr if the ring is empty */
+    SampleBlock* beginRead()
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+
+        if (t == head.load(std::memory_order_acquire))
+            return nullptr;
+
+        return &slots[t];
+    }
+
+    /** Hands the slot returned by beginRead() back to the producer */
+    void commitRead()
+    {
+        tail.store(next(tail.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+    /** Number of filled slots (approximate when called from a third thread) */
+    int getNumReady() const
+    {
+        const size_t h = head.load(std::memory_order_acquire);
+        const size_t t = tail.load(std::memory_order_acquire);
+
+        return int(h >= t ? h - t : h + slots.size() - t);
+    }
+
+    /** Number of usable slots */
+    int getCapacity() const { return slots.empty() ? 0 : int(slots.size()) - 1; }
+
+private:
+
+    size_t next(size_t i) const { return i + 1 == slots.size() ? 0 : i + 1; }
+
+    std::vector<SampleBlock> slots;
+
+    alignas(64) std::atomic<size_t> head { 0 };
+    alignas(64) std::atomic<size_t> tail { 0 };
+};
+
+#endif  // SAMPLEBLOCKRING_H_INCLUDED
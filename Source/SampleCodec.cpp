@@ -0,0 +1,300 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "SampleCodec.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    inline int16_t toCount(float value, float scale)
+    {
+        float count = value * scale;
+
+        count = count < -32768.0f ? -32768.0f : (count > 32767.0f ? 32767.0f : count);
+
+        // Branch-free round half away from zero, so that the loops vectorize
+        return int16_t(count + std::copysign(0.5f, count));
+    }
+
+    inline float inverse(float bitVolts)
+    {
+        return bitVolts != 0.0f ? 1.0f / bitVolts : 0.0f;
+    }
+
+    inline uint32_t zigzag(int32_t value)
+    {
+        return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+    }
+
+    inline int32_t unzigzag(uint32_t value)
+    {
+        return int32_t(value >> 1) ^ -int32_t(value & 1);
+    }
+
+    inline int bitWidth(uint32_t value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return value == 0 ? 0 : 32 - __builtin_clz(value);
+#else
+        int width = 0;
+
+        while (value)
+        {
+            width++;
+            value >>= 1;
+        }
+
+        return width;
+#endif
+    }
+
+    inline void storeWord(uint8_t* dst, uint32_t value)
+    {
+        dst[0] = uint8_t(value);
+        dst[1] = uint8_t(value >> 8);
+        dst[2] = uint8_t(value >> 16);
+        dst[3] = uint8_t(value >> 24);
+    }
+
+    inline uint32_t loadWord(const uint8_t* src)
+    {
+        return uint32_t(src[0]) | (uint32_t(src[1]) << 8) | (uint32_t(src[2]) << 16) | (uint32_t(src[3]) << 24);
+    }
+
+    /** Writes the bit width of the frame followed by its residuals, LSB first */
+    uint8_t* packFrame(const uint32_t* residuals, int count, uint8_t* dst)
+    {
+        uint32_t all = 0;
+
+        for (int i = 0; i < count; i++)
+            all |= residuals[i];
+
+        const int width = bitWidth(all);
+        *dst++ = uint8_t(width);
+
+        uint64_t acc = 0;
+        int bits = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            acc |= uint64_t(residuals[i]) << bits;
+            bits += width;
+
+            if (bits >= 32)
+            {
+                storeWord(dst, uint32_t(acc));
+                dst += 4;
+                acc >>= 32;
+                bits -= 32;
+            }
+        }
+
+        while (bits > 0)
+        {
+            *dst++ = uint8_t(acc);
+            acc >>= 8;
+            bits -= 8;
+        }
+
+        return dst;
+    }
+
+    /** Reads a frame written by packFrame(); returns nullptr if it does not fit in [src, end) */
+    const uint8_t* unpackFrame(const uint8_t* src, const uint8_t* end, int count, uint32_t* residuals)
+    {
+        if (src >= end)
+            return nullptr;
+
+        const int width = *src++;
+
+        if (width > 32 || size_t(end - src) < (size_t(count) * width + 7) / 8)
+            return nullptr;
+
+        const uint8_t* frameEnd = src + (size_t(count) * width + 7) / 8;
+        const uint32_t mask = width == 32 ? 0xffffffffu : (1u << width) - 1;
+
+        uint64_t acc = 0;
+        int bits = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            if (bits < width)
+            {
+                if (frameEnd - src >= 4)
+                {
+                    acc |= uint64_t(loadWord(src)) << bits;
+                    src += 4;
+                    bits += 32;
+                }
+                else
+                {
+                    while (bits < width)
+                    {
+                        acc |= uint64_t(*src++) << bits;
+                        bits += 8;
+                    }
+                }
+            }
+
+            residuals[i] = uint32_t(acc) & mask;
+            acc >>= width;
+            bits -= width;
+        }
+
+        return frameEnd;
+    }
+}
+
+void SampleCodec::quantize(const float* src, int n, float bitVolts, int16_t* dst)
+{
+    const float scale = inverse(bitVolts);
+
+    for (int i = 0; i < n; i++)
+        dst[i] = toCount(src[i], scale);
+}
+
+void SampleCodec::quantizeStrided(const float* src, int n, float bitVolts, int16_t* dst, int dstStride)
+{
+    const float scale = inverse(bitVolts);
+
+    for (int i = 0; i < n; i++)
+        dst[size_t(i) * dstStride] = toCount(src[i], scale);
+}
+
+void SampleCodec::dequantize(const int16_t* src, int n, float bitVolts, float* dst)
+{
+    for (int i = 0; i < n; i++)
+        dst[i] = float(src[i]) * bitVolts;
+}
+
+void SampleCodec::dequantizeInterleaved(const int16_t* src, int nChannels, int nSamples, const float* bitVolts, float* dst)
+{
+    for (int i = 0; i < nSamples; i++)
+    {
+        const size_t offset = size_t(i) * nChannels;
+
+        for (int ch = 0; ch < nChannels; ch++)
+            dst[offset + ch] = float(src[offset + ch]) * bitVolts[ch];
+    }
+}
+
+size_t SampleCodec::getMaxCompressedSize(int nChannels, int nSamples)
+{
+    const size_t frames = (size_t(nSamples) + COMPRESSION_FRAME - 1) / COMPRESSION_FRAME;
+
+    return size_t(nChannels) * (frames + size_t(nSamples) * sizeof(uint32_t));
+}
+
+size_t SampleCodec::compress(const float* const* channels, int nChannels, int nSamples, const float* bitVolts, uint8_t* dst)
+{
+    uint32_t residuals[COMPRESSION_FRAME];
+    int32_t counts[COMPRESSION_FRAME];
+    uint8_t* out = dst;
+
+    for (int ch = 0; ch < nChannels; ch++)
+    {
+        const float* x = channels[ch];
+        const float scale = bitVolts != nullptr ? inverse(bitVolts[ch]) : 0.0f;
+
+        int32_t previousCount = 0;
+        uint32_t previousBits = 0;
+
+        for (int start = 0; start < nSamples; start += COMPRESSION_FRAME)
+        {
+            const int count = nSamples - start < COMPRESSION_FRAME ? nSamples - start : COMPRESSION_FRAME;
+
+            if (bitVolts != nullptr)
+            {
+                for (int i = 0; i < count; i++)
+                    counts[i] = toCount(x[start + i], scale);
+
+                residuals[0] = zigzag(counts[0] - previousCount);
+
+                for (int i = 1; i < count; i++)
+                    residuals[i] = zigzag(counts[i] - counts[i - 1]);
+
+                previousCount = counts[count - 1];
+            }
+            else
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    uint32_t value;
+                    memcpy(&value, x + start + i, sizeof(value));
+                    residuals[i] = value ^ previousBits;
+                    previousBits = value;
+                }
+            }
+
+            out = packFrame(residuals, count, out);
+        }
+    }
+
+    return size_t(out - dst);
+}
+
+bool SampleCodec::decompress(const uint8_t* src, size_t size, int nChannels, int nSamples, const float* bitVolts, float* dst)
+{
+    uint32_t residuals[COMPRESSION_FRAME];
+    const uint8_t* end = src + size;
+
+    for (int ch = 0; ch < nChannels; ch++)
+    {
+        float* x = dst + size_t(ch) * nSamples;
+
+        int32_t previousCount = 0;
+        uint32_t previousBits = 0;
+
+        for (int start = 0; start < nSamples; start += COMPRESSION_FRAME)
+        {
+            const int count = nSamples - start < COMPRESSION_FRAME ? nSamples - start : COMPRESSION_FRAME;
+
+            src = unpackFrame(src, end, count, residuals);
+
+            if (src == nullptr)
+                return false;
+
+            if (bitVolts != nullptr)
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    previousCount += unzigzag(residuals[i]);
+                    x[start + i] = float(previousCount) * bitVolts[ch];
+                }
+            }
+            else
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    previousBits ^= residuals[i];
+                    memcpy(x + start + i, &previousBits, sizeof(previousBits));
+                }
+            }
+        }
+    }
+
+    return src == end;
+}
@@ -0,0 +1,71 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SAMPLECODEC_H_INCLUDED
+#define SAMPLECODEC_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+    Conversions between float samples and the compact encodings of
+    ContinuousData packets.
+*/
+namespace SampleCodec
+{
+    /** Converts n samples to ADC counts: dst[i] = round(src[i] / bitVolts), saturated to int16 */
+    void quantize(const float* src, int n, float bitVolts, int16_t* dst);
+
+    /** Same as quantize(), but writes every dstStride-th value (used to interleave channels) */
+    void quantizeStrided(const float* src, int n, float bitVolts, int16_t* dst, int dstStride);
+
+    /** Converts n ADC counts back to float samples: dst[i] = src[i] * bitVolts */
+    void dequantize(const int16_t* src, int n, float bitVolts, float* dst);
+
+    /** Converts interleaved ADC counts back to float samples, using the bitVolts of each channel */
+    void dequantizeInterleaved(const int16_t* src, int nChannels, int nSamples, const float* bitVolts, float* dst);
+
+    /** Number of values per bit-packed frame of the compressed stream */
+    const int COMPRESSION_FRAME = 128;
+
+    /** Largest number of bytes compress() can produce for a block */
+    size_t getMaxCompressedSize(int nChannels, int nSamples);
+
+    /**
+        Losslessly compresses a block, channel by channel, into dst (which must hold
+        getMaxCompressedSize() bytes) and returns the number of bytes written.
+
+        If bitVolts is given, the samples are first quantized to int16 ADC counts and
+        the differences between successive counts are coded; otherwise the float bits
+        are XORed with those of the previous sample. The residuals are bit-packed in
+        frames of COMPRESSION_FRAME values, each preceded by a one byte bit width.
+        Every block is self-contained, so a lost packet does not affect the next one.
+    */
+    size_t compress(const float* const* channels, int nChannels, int nSamples, const float* bitVolts, uint8_t* dst);
+
+    /** Reverses compress() into channel-major floats; returns false if the stream is truncated or corrupt */
+    bool decompress(const uint8_t* src, size_t size, int nChannels, int nSamples, const float* bitVolts, float* dst);
+}
+
+#endif  // SAMPLECODEC_H_INCLUDED
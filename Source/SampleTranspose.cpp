@@ -0,0 +1,226 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "SampleTranspose.h"
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FALCON_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define FALCON_TARGET_AVX
+#define FALCON_TARGET_SSE
+#else
+#define FALCON_TARGET_AVX __attribute__((target("avx")))
+#define FALCON_TARGET_SSE __attribute__((target("sse2")))
+#endif
+#endif
+
+namespace
+{
+    const int BLOCK = 8;
+
+    /** Copies a partial tile element by element */
+    void interleaveTileScalar(const float* const* rows, int row0, int rowEnd, int col0, int colEnd,
+                              float* dst, int dstStride)
+    {
+        for (int r = row0; r < rowEnd; r++)
+        {
+            const float* src = rows[r];
+
+            for (int c = col0; c < colEnd; c++)
+                dst[size_t(c) * dstStride + r] = src[c];
+        }
+    }
+
+    void interleaveScalar(const float* const* rows, int nRows, int nCols, float* dst, int dstStride)
+    {
+        for (int r = 0; r < nRows; r += BLOCK)
+        {
+            const int rowEnd = r + BLOCK < nRows ? r + BLOCK : nRows;
+
+            for (int c = 0; c < nCols; c += BLOCK)
+                interleaveTileScalar(rows, r, rowEnd, c, c + BLOCK < nCols ? c + BLOCK : nCols, dst, dstStride);
+        }
+    }
+
+#ifdef FALCON_X86
+
+    FALCON_TARGET_SSE
+    void interleaveSse(const float* const* rows, int nRows, int nCols, float* dst, int dstStride)
+    {
+        const int fullRows = nRows & ~3;
+        const int fullCols = nCols & ~3;
+
+        for (int r = 0; r < fullRows; r += 4)
+        {
+            const float* r0 = rows[r];
+            const float* r1 = rows[r + 1];
+            const float* r2 = rows[r + 2];
+            const float* r3 = rows[r + 3];
+
+            for (int c = 0; c < fullCols; c += 4)
+            {
+                __m128 a = _mm_loadu_ps(r0 + c);
+                __m128 b = _mm_loadu_ps(r1 + c);
+                __m128 d = _mm_loadu_ps(r2 + c);
+                __m128 e = _mm_loadu_ps(r3 + c);
+
+                _MM_TRANSPOSE4_PS(a, b, d, e);
+
+                float* out = dst + size_t(c) * dstStride + r;
+                _mm_storeu_ps(out, a);
+                _mm_storeu_ps(out + dstStride, b);
+                _mm_storeu_ps(out + 2 * size_t(dstStride), d);
+                _mm_storeu_ps(out + 3 * size_t(dstStride), e);
+            }
+
+            interleaveTileScalar(rows, r, r + 4, fullCols, nCols, dst, dstStride);
+        }
+
+        interleaveTileScalar(rows, fullRows, nRows, 0, nCols, dst, dstStride);
+    }
+
+    FALCON_TARGET_AVX
+    void interleaveAvx(const float* const* rows, int nRows, int nCols, float* dst, int dstStride)
+    {
+        const int fullRows = nRows & ~7;
+        const int fullCols = nCols & ~7;
+
+        for (int r = 0; r < fullRows; r += 8)
+        {
+            for (int c = 0; c < fullCols; c += 8)
+            {
+                __m256 v0 = _mm256_loadu_ps(rows[r] + c);
+                __m256 v1 = _mm256_loadu_ps(rows[r + 1] + c);
+                __m256 v2 = _mm256_loadu_ps(rows[r + 2] + c);
+                __m256 v3 = _mm256_loadu_ps(rows[r + 3] + c);
+                __m256 v4 = _mm256_loadu_ps(rows[r + 4] + c);
+                __m256 v5 = _mm256_loadu_ps(rows[r + 5] + c);
+                __m256 v6 = _mm256_loadu_ps(rows[r + 6] + c);
+                __m256 v7 = _mm256_loadu_ps(rows[r + 7] + c);
+
+                __m256 t0 = _mm256_unpacklo_ps(v0, v1);
+                __m256 t1 = _mm256_unpackhi_ps(v0, v1);
+                __m256 t2 = _mm256_unpacklo_ps(v2, v3);
+                __m256 t3 = _mm256_unpackhi_ps(v2, v3);
+                __m256 t4 = _mm256_unpacklo_ps(v4, v5);
+                __m256 t5 = _mm256_unpackhi_ps(v4, v5);
+                __m256 t6 = _mm256_unpacklo_ps(v6, v7);
+                __m256 t7 = _mm256_unpackhi_ps(v6, v7);
+
+                __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+                float* out = dst + size_t(c) * dstStride + r;
+                _mm256_storeu_ps(out, _mm256_permute2f128_ps(s0, s4, 0x20));
+                _mm256_storeu_ps(out + dstStride, _mm256_permute2f128_ps(s1, s5, 0x20));
+                _mm256_storeu_ps(out + 2 * size_t(dstStride), _mm256_permute2f128_ps(s2, s6, 0x20));
+                _mm256_storeu_ps(out + 3 * size_t(dstStride), _mm256_permute2f128_ps(s3, s7, 0x20));
+                _mm256_storeu_ps(out + 4 * size_t(dstStride), _mm256_permute2f128_ps(s0, s4, 0x31));
+                _mm256_storeu_ps(out + 5 * size_t(dstStride), _mm256_permute2f128_ps(s1, s5, 0x31));
+                _mm256_storeu_ps(out + 6 * size_t(dstStride), _mm256_permute2f128_ps(s2, s6, 0x31));
+                _mm256_storeu_ps(out + 7 * size_t(dstStride), _mm256_permute2f128_ps(s3, s7, 0x31));
+            }
+
+            interleaveTileScalar(rows, r, r + 8, fullCols, nCols, dst, dstStride);
+        }
+
+        interleaveTileScalar(rows, fullRows, nRows, 0, nCols, dst, dstStride);
+    }
+
+    bool cpuHasAvx()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+
+        return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#else
+        return __builtin_cpu_supports("avx");
+#endif
+    }
+
+    bool cpuHasSse()
+    {
+#if defined(_M_X64) || defined(__x86_64__)
+        return true;
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+#else
+        return __builtin_cpu_supports("sse2");
+#endif
+    }
+
+#endif
+
+    typedef void (*InterleaveFn)(const float* const*, int, int, float*, int);
+
+    struct Kernel
+    {
+        InterleaveFn fn;
+        const char* name;
+    };
+
+    Kernel selectKernel()
+    {
+#ifdef FALCON_X86
+        if (cpuHasAvx())
+            return { interleaveAvx, "avx" };
+
+        if (cpuHasSse())
+            return { interleaveSse, "sse" };
+#endif
+        return { interleaveScalar, "scalar" };
+    }
+
+    const Kernel& getKernel()
+    {
+        static const Kernel kernel = selectKernel();
+        return kernel;
+    }
+}
+
+void SampleTranspose::interleave(const float* const* rows, int nRows, int nCols, float* dst, int dstStride)
+{
+    getKernel().fn(rows, nRows, nCols, dst, dstStride);
+}
+
+const char* SampleTranspose::getKernelName()
+{
+    return getKernel().name;
+}
@@ -0,0 +1,45 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SAMPLETRANSPOSE_H_INCLUDED
+#define SAMPLETRANSPOSE_H_INCLUDED
+
+/**
+    Blocked float matrix transpose used to convert between channel-major
+    (one row per channel) and sample-major (interleaved) sample layouts.
+
+    The AVX or SSE kernel is picked at runtime depending on the CPU,
+    with a scalar fallback, so the same binary runs on older machines.
+*/
+namespace SampleTranspose
+{
+    /** Writes dst[col * dstStride + row] = rows[row][col] for every row < nRows and col < nCols.
+        dstStride must be >= nRows; the remaining columns of each output row are left untouched. */
+    void interleave(const float* const* rows, int nRows, int nCols, float* dst, int dstStride);
+
+    /** Name of the kernel selected for this CPU ("avx", "sse" or "scalar") */
+    const char* getKernelName();
+}
+
+#endif  // SAMPLETRANSPOSE_H_INCLUDED
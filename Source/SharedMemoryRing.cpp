@@ -0,0 +1,376 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "SharedMemoryRing.h"
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace
+{
+    const uint32_t RING_MAGIC = 0x46414c43;  // "FALC"
+    const uint32_t RING_VERSION = 1;
+    const size_t CACHE_LINE = 64;
+
+    /** Slot sequence while the writer is filling it */
+    const uint64_t SLOT_BUSY = ~uint64_t(0);
+
+    size_t roundUp(size_t bytes)
+    {
+        return (bytes + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+    }
+}
+
+struct alignas(64) SharedMemoryRing::Header
+{
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotSize;
+    uint64_t slotStride;
+    std::atomic<uint32_t> closed;
+
+    /** Number of packets published so far */
+    alignas(64) std::atomic<uint64_t> writeSequence;
+
+    /** Bumped on every packet; readers sleep on it */
+    alignas(64) std::atomic<uint32_t> wakeWord;
+    std::atomic<uint32_t> waiters;
+};
+
+struct alignas(64) SharedMemoryRing::Slot
+{
+    /** Sequence number of the packet + 1, 0 if never written, SLOT_BUSY while being written */
+    std::atomic<uint64_t> sequence;
+    uint64_t size;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "Shared memory synchronization needs lock-free atomics");
+
+SharedMemoryRing::SharedMemoryRing()
+    : header(nullptr),
+      mappedBytes(0),
+      isWriter(false),
+      nextSequence(0),
+      droppedFrames(0)
+{
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+    close();
+}
+
+std::string SharedMemoryRing::getSegmentName(int port)
+{
+    return "/falcon-output-" + std::to_string(port);
+}
+
+size_t SharedMemoryRing::getSlotSize() const
+{
+    return header != nullptr ? header->slotSize : 0;
+}
+
+SharedMemoryRing::Slot* SharedMemoryRing::getSlot(uint64_t sequence) const
+{
+    uint8_t* slots = reinterpret_cast<uint8_t*>(header) + sizeof(Header);
+    return reinterpret_cast<Slot*>(slots + (sequence % header->slotCount) * header->slotStride);
+}
+
+#ifdef _WIN32
+
+bool SharedMemoryRing::map(const std::string&, size_t, bool)
+{
+    return false;
+}
+
+void SharedMemoryRing::unmap()
+{
+    header = nullptr;
+}
+
+bool SharedMemoryRing::create(const std::string&, int, size_t)
+{
+    return false;
+}
+
+#else
+
+bool SharedMemoryRing::map(const std::string& name, size_t bytes, bool writer)
+{
+    int fd = writer ? shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666)
+                    : shm_open(name.c_str(), O_RDWR, 0);
+
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+
+    if (writer ? ftruncate(fd, off_t(bytes)) != 0 : fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    if (!writer)
+        bytes = size_t(info.st_size);
+
+    void* address = bytes >= sizeof(Header) ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+
+    if (address == MAP_FAILED)
+        return false;
+
+    header = static_cast<Header*>(address);
+    mappedBytes = bytes;
+    isWriter = writer;
+    segmentName = name;
+
+    if (!writer)
+    {
+        // The writer may still be initializing the header, or the segment may be from another version
+        if (header->magic.load(std::memory_order_acquire) != RING_MAGIC || header->version != RING_VERSION
+            || header->slotCount == 0
+            || sizeof(Header) + uint64_t(header->slotCount) * header->slotStride > mappedBytes)
+        {
+            unmap();
+            return false;
+        }
+
+        nextSequence = header->writeSequence.load(std::memory_order_acquire);
+
+        if (frame.size() < header->slotSize)
+            frame.resize(header->slotSize);
+    }
+
+    return true;
+}
+
+void SharedMemoryRing::unmap()
+{
+    if (header != nullptr)
+        munmap(header, mappedBytes);
+
+    header = nullptr;
+    mappedBytes = 0;
+}
+
+bool SharedMemoryRing::create(const std::string& name, int slotCount, size_t slotSize)
+{
+    // Sequence numbers carry on when the segment is recreated with larger slots
+    const uint64_t firstSequence = header != nullptr && isWriter ? header->writeSequence.load() : 0;
+
+    close();
+    shm_unlink(name.c_str());
+
+    const size_t stride = roundUp(sizeof(Slot) + slotSize);
+
+    if (!map(name, sizeof(Header) + stride * slotCount, true))
+        return false;
+
+    // ftruncate() zero-fills the segment, so only the non-zero fields are set
+    header->version = RING_VERSION;
+    header->slotCount = uint32_t(slotCount);
+    header->slotSize = uint32_t(stride - sizeof(Slot));
+    header->slotStride = stride;
+    header->writeSequence.store(firstSequence);
+    header->magic.store(RING_MAGIC, std::memory_order_release);
+
+    return true;
+}
+
+#endif
+
+bool SharedMemoryRing::open(const std::string& name)
+{
+    close();
+
+    segmentName = name;
+    droppedFrames = 0;
+
+    return map(name, 0, false);
+}
+
+void SharedMemoryRing::close()
+{
+    if (header != nullptr && isWriter)
+    {
+        header->closed.store(1, std::memory_order_release);
+        header->wakeWord.fetch_add(1);
+
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&header->wakeWord), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+#ifndef _WIN32
+        shm_unlink(segmentName.c_str());
+#endif
+    }
+
+    unmap();
+    isWriter = false;
+}
+
+bool SharedMemoryRing::write(const void* data, size_t size)
+{
+    if (header == nullptr || !isWriter || size > header->slotSize)
+        return false;
+
+    const uint64_t sequence = header->writeSequence.load(std::memory_order_relaxed);
+    Slot* slot = getSlot(sequence);
+
+    // Seqlock: readers that copied this slot while it was being rewritten see a different sequence afterwards
+    slot->sequence.store(SLOT_BUSY, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->size = size;
+    memcpy(reinterpret_cast<uint8_t*>(slot) + sizeof(Slot), data, size);
+
+    slot->sequence.store(sequence + 1, std::memory_order_release);
+    header->writeSequence.store(sequence + 1);
+
+    // Only pay for the system call when a reader is asleep
+    header->wakeWord.fetch_add(1);
+
+#ifdef __linux__
+    if (header->waiters.load() > 0)
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&header->wakeWord), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+
+    return true;
+}
+
+bool SharedMemoryRing::waitForData(int timeoutMs)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    while (true)
+    {
+        if (header->closed.load(std::memory_order_acquire) || header->writeSequence.load() > nextSequence)
+            return true;
+
+        const auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+
+        if (remaining.count() <= 0)
+            return false;
+
+#ifdef __linux__
+        const uint32_t word = header->wakeWord.load();
+        header->waiters.fetch_add(1);
+
+        if (header->writeSequence.load() <= nextSequence && !header->closed.load())
+        {
+            struct timespec timeout;
+            timeout.tv_sec = time_t(remaining.count() / 1000000);
+            timeout.tv_nsec = long(remaining.count() % 1000000) * 1000;
+
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&header->wakeWord), FUTEX_WAIT, word, &timeout, nullptr, 0);
+        }
+
+        header->waiters.fetch_sub(1);
+#else
+        std::this_thread::sleep_for(std::chrono::microseconds(remaining.count() < 100 ? remaining.count() : 100));
+#endif
+    }
+}
+
+const uint8_t* SharedMemoryRing::read(size_t& size, int timeoutMs)
+{
+    if (isWriter)
+        return nullptr;
+
+    // Follow the writer to a new segment, or wait for it to create one
+    if (header == nullptr || header->closed.load(std::memory_order_acquire))
+    {
+        unmap();
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+        while (segmentName.empty() || !map(segmentName, 0, false))
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+                return nullptr;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    while (waitForData(timeoutMs))
+    {
+        if (header->closed.load(std::memory_order_acquire))
+            return nullptr;
+
+        // Skip the packets that were overwritten; the oldest slot may be being rewritten
+        const uint64_t available = header->writeSequence.load(std::memory_order_acquire);
+
+        if (available - nextSequence >= header->slotCount)
+        {
+            const uint64_t oldest = available - header->slotCount + 1;
+            droppedFrames += oldest - nextSequence;
+            nextSequence = oldest;
+        }
+
+        Slot* slot = getSlot(nextSequence);
+
+        if (slot->sequence.load(std::memory_order_acquire) != nextSequence + 1)
+            continue;
+
+        const size_t slotBytes = size_t(slot->size);
+
+        if (slotBytes > header->slotSize)
+        {
+            droppedFrames++;
+            nextSequence++;
+            continue;
+        }
+
+        memcpy(frame.data(), reinterpret_cast<const uint8_t*>(slot) + sizeof(Slot), slotBytes);
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot->sequence.load(std::memory_order_relaxed) != nextSequence + 1)
+            continue;
+
+        nextSequence++;
+        size = slotBytes;
+
+        return frame.data();
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,109 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SHAREDMEMORYRING_H_INCLUDED
+#define SHAREDMEMORYRING_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+    Ring of packets in a POSIX shared memory segment, for consumers on the same host.
+
+    A single writer publishes each packet into the next of a fixed number of
+    cache-line aligned slots, tagged with its sequence number; it never waits for
+    the readers, so a reader that falls behind by more than the ring size loses
+    packets (counted by getDroppedFrames()). Any number of readers can map the
+    segment. On Linux, waiting readers sleep on a futex that the writer only
+    signals when somebody is waiting; elsewhere they poll.
+
+    The writer recreates the segment when a packet no longer fits in a slot;
+    readers notice that the old segment was closed and map the new one.
+*/
+class SharedMemoryRing
+{
+public:
+
+    /** Constructor */
+    SharedMemoryRing();
+
+    /** Destructor */
+    ~SharedMemoryRing();
+
+    /** Name of the segment used by a Falcon Output publishing on the given port */
+    static std::string getSegmentName(int port);
+
+    /** Creates (or recreates) the segment as its writer; returns false if shared memory is unavailable */
+    bool create(const std::string& name, int slotCount, size_t slotSize);
+
+    /** Publishes a packet; returns false if it is larger than getSlotSize() */
+    bool write(const void* data, size_t size);
+
+    /** Maps an existing segment as a reader; read() keeps retrying if it does not exist yet */
+    bool open(const std::string& name);
+
+    /**
+        Returns the next packet (valid until the next call) and sets size, or nullptr
+        if none arrived within timeoutMs. Starts from the newest packet after open().
+    */
+    const uint8_t* read(size_t& size, int timeoutMs);
+
+    /** Unmaps the segment; the writer also removes it and tells the readers */
+    void close();
+
+    /** True if a segment is mapped */
+    bool isOpen() const { return header != nullptr; }
+
+    /** Largest packet that fits in a slot */
+    size_t getSlotSize() const;
+
+    /** Sequence number of the last packet returned by read() */
+    uint64_t getLastSequence() const { return nextSequence - 1; }
+
+    /** Packets overwritten before this reader got to them */
+    uint64_t getDroppedFrames() const { return droppedFrames; }
+
+    struct Header;
+    struct Slot;
+
+private:
+
+    bool map(const std::string& name, size_t bytes, bool writer);
+    void unmap();
+    Slot* getSlot(uint64_t sequence) const;
+    bool waitForData(int timeoutMs);
+
+    Header* header;
+    size_t mappedBytes;
+    bool isWriter;
+    std::string segmentName;
+
+    uint64_t nextSequence;
+    uint64_t droppedFrames;
+    std::vector<uint8_t> frame;
+};
+
+#endif  // SHAREDMEMORYRING_H_INCLUDED
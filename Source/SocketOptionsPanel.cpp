@@ -0,0 +1,135 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "SocketOptionsPanel.h"
+
+const int PANEL_WIDTH = 220;
+const int ROW_HEIGHT = 25;
+
+SocketOptionsPanel::SocketOptionsPanel(const ZmqTransport::SocketOptions& options_, bool send,
+                                       std::function<void(const ZmqTransport::SocketOptions&)> onChange_)
+    : options(options_), onChange(onChange_)
+{
+    highWaterMarkInput = addField(send ? "Send HWM" : "Receive HWM", "",
+                                  "Messages queued per peer before new ones are dropped (0 = no limit)");
+    bufferSizeInput = addField(send ? "Send buffer (B)" : "Receive buffer (B)", "",
+                               "Kernel socket buffer in bytes (0 = OS default)");
+    ioThreadsInput = addField("I/O threads", "", "Background threads of the ZeroMQ context (tcp and ipc)");
+    affinityInput = addField("Affinity", "", "Bitmask of the I/O threads that serve this socket (0 = any)");
+    conflateButton = addToggle("Latest only (conflate)", false,
+                               "Only keep the most recent packet, for viewers that should never fall behind. "
+                               "Not compatible with multi-stream mode");
+    tcpKeepaliveButton = addToggle("TCP keepalive", false, "Detect dead peers on long-lived tcp connections");
+
+    updateFields();
+
+    setSize(PANEL_WIDTH, nextRow + 5);
+}
+
+Label* SocketOptionsPanel::addField(const String& name, const String& value, const String& tooltip)
+{
+    Label* caption = new Label(name, name);
+    caption->setFont(Font("Small Text", 12, Font::plain));
+    caption->setBounds(5, nextRow, 120, 20);
+    caption->setColour(Label::textColourId, Colours::white);
+    components.add(caption);
+    addAndMakeVisible(caption);
+
+    Label* input = new Label(name, value);
+    input->setFont(Font("Small Text", 12, Font::plain));
+    input->setBounds(130, nextRow, 85, 20);
+    input->setColour(Label::backgroundColourId, Colours::lightgrey);
+    input->setColour(Label::textColourId, Colours::black);
+    input->setEditable(true);
+    input->setTooltip(tooltip);
+    input->addListener(this);
+    components.add(input);
+    addAndMakeVisible(input);
+
+    nextRow += ROW_HEIGHT;
+
+    return input;
+}
+
+ToggleButton* SocketOptionsPanel::addToggle(const String& name, bool value, const String& tooltip)
+{
+    ToggleButton* button = new ToggleButton(name);
+    button->setBounds(5, nextRow, PANEL_WIDTH - 10, 20);
+    button->setToggleState(value, dontSendNotification);
+    button->setColour(ToggleButton::textColourId, Colours::white);
+    button->setTooltip(tooltip);
+    button->addListener(this);
+    components.add(button);
+    addAndMakeVisible(button);
+
+    nextRow += ROW_HEIGHT;
+
+    return button;
+}
+
+void SocketOptionsPanel::updateFields()
+{
+    highWaterMarkInput->setText(String(options.highWaterMark), dontSendNotification);
+    bufferSizeInput->setText(String(options.bufferSize), dontSendNotification);
+    ioThreadsInput->setText(String(options.ioThreads), dontSendNotification);
+    affinityInput->setText(String((int64) options.affinity), dontSendNotification);
+    conflateButton->setToggleState(options.conflate, dontSendNotification);
+    tcpKeepaliveButton->setToggleState(options.tcpKeepalive, dontSendNotification);
+}
+
+void SocketOptionsPanel::labelTextChanged(Label* label)
+{
+    const String text = label->getText().trim();
+    const bool isNumber = text.isNotEmpty() && text.containsOnly("0123456789");
+    const int64 value = text.getLargeIntValue();
+
+    ZmqTransport::SocketOptions edited = options;
+
+    if (label == highWaterMarkInput && isNumber && value <= 10000000)
+        edited.highWaterMark = int(value);
+    else if (label == bufferSizeInput && isNumber && value <= 256 * 1024 * 1024)
+        edited.bufferSize = int(value);
+    else if (label == ioThreadsInput && isNumber && value >= 1 && value <= 16)
+        edited.ioThreads = int(value);
+    else if (label == affinityInput && isNumber && value <= 0xffff)
+        edited.affinity = uint64(value);
+
+    if (edited != options)
+    {
+        options = edited;
+        onChange(options);
+    }
+
+    updateFields();
+}
+
+void SocketOptionsPanel::buttonClicked(Button* button)
+{
+    if (button == conflateButton)
+        options.conflate = button->getToggleState();
+    else if (button == tcpKeepaliveButton)
+        options.tcpKeepalive = button->getToggleState();
+
+    onChange(options);
+}
@@ -0,0 +1,83 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SOCKETOPTIONSPANEL_H_INCLUDED
+#define SOCKETOPTIONSPANEL_H_INCLUDED
+
+#include <EditorHeaders.h>
+
+#include "ZmqTransport.h"
+
+#include <functional>
+
+/**
+    Pop-up panel of the advanced ZeroMQ settings of Falcon Output and Falcon Input.
+
+    Every valid edit is reported through onChange with the complete set of options;
+    invalid values are reverted.
+*/
+class SocketOptionsPanel : public Component,
+                           public Label::Listener,
+                           public Button::Listener
+{
+public:
+
+    /** Constructor; send selects the labels of the publisher side */
+    SocketOptionsPanel(const ZmqTransport::SocketOptions& options, bool send,
+                       std::function<void(const ZmqTransport::SocketOptions&)> onChange);
+
+    /** Validates and applies an edited value */
+    void labelTextChanged(Label* label) override;
+
+    /** Applies a toggled option */
+    void buttonClicked(Button* button) override;
+
+private:
+
+    /** Adds a caption and an editable value in the next row */
+    Label* addField(const String& name, const String& value, const String& tooltip);
+
+    /** Adds a toggle in the next row */
+    ToggleButton* addToggle(const String& name, bool value, const String& tooltip);
+
+    /** Shows the current options in every field */
+    void updateFields();
+
+    ZmqTransport::SocketOptions options;
+    std::function<void(const ZmqTransport::SocketOptions&)> onChange;
+
+    OwnedArray<Component> components;
+    int nextRow = 5;
+
+    Label* highWaterMarkInput;
+    Label* bufferSizeInput;
+    Label* ioThreadsInput;
+    Label* affinityInput;
+    ToggleButton* conflateButton;
+    ToggleButton* tcpKeepaliveButton;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SocketOptionsPanel);
+};
+
+#endif  // SOCKETOPTIONSPANEL_H_INCLUDED
@@ -0,0 +1,106 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ZmqTransport.h"
+
+#include <zmq.h>
+
+std::string ZmqTransport::getBindEndpoint(Type type, int port, const std::string& ipcPath)
+{
+    switch (type)
+    {
+        case IPC:
+            return "ipc://" + ipcPath;
+
+        case INPROC:
+            return "inproc://falcon-output-" + std::to_string(port);
+
+        default:
+            return "tcp://*:" + std::to_string(port);
+    }
+}
+
+std::string ZmqTransport::getConnectEndpoint(Type type, const std::string& address, int port, const std::string& ipcPath)
+{
+    switch (type)
+    {
+        case IPC:
+            return "ipc://" + ipcPath;
+
+        case INPROC:
+            return "inproc://falcon-output-" + std::to_string(port);
+
+        default:
+            return "tcp://" + address + ":" + std::to_string(port);
+    }
+}
+
+void* ZmqTransport::getSharedContext()
+{
+    static void* context = zmq_ctx_new();
+    return context;
+}
+
+bool ZmqTransport::SocketOptions::operator==(const SocketOptions& other) const
+{
+    return highWaterMark == other.highWaterMark
+        && bufferSize == other.bufferSize
+        && ioThreads == other.ioThreads
+        && affinity == other.affinity
+        && conflate == other.conflate
+        && tcpKeepalive == other.tcpKeepalive;
+}
+
+void* ZmqTransport::createContext(const SocketOptions& options)
+{
+    void* context = zmq_ctx_new();
+
+    if (context != nullptr && options.ioThreads > 1)
+        zmq_ctx_set(context, ZMQ_IO_THREADS, options.ioThreads);
+
+    return context;
+}
+
+void ZmqTransport::applySocketOptions(void* socket, const SocketOptions& options, bool send)
+{
+    zmq_setsockopt(socket, send ? ZMQ_SNDHWM : ZMQ_RCVHWM, &options.highWaterMark, sizeof(options.highWaterMark));
+
+    if (options.bufferSize > 0)
+        zmq_setsockopt(socket, send ? ZMQ_SNDBUF : ZMQ_RCVBUF, &options.bufferSize, sizeof(options.bufferSize));
+
+    if (options.affinity != 0)
+        zmq_setsockopt(socket, ZMQ_AFFINITY, &options.affinity, sizeof(options.affinity));
+
+    if (options.conflate)
+    {
+        int conflate = 1;
+        zmq_setsockopt(socket, ZMQ_CONFLATE, &conflate, sizeof(conflate));
+    }
+
+    if (options.tcpKeepalive)
+    {
+        int keepalive = 1;
+        zmq_setsockopt(socket, ZMQ_TCP_KEEPALIVE, &keepalive, sizeof(keepalive));
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef ZMQTRANSPORT_H_INCLUDED
+#define ZMQTRANSPORT_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+/**
+    Builds the ZeroMQ endpoints used between Falcon Output and its subscribers.
+
+    tcp works across hosts; ipc (Unix domain sockets) avoids the TCP loopback
+    stack for consumers on the same host; inproc only works between sockets
+    created from the same context, so both sides must use getSharedContext().
+*/
+namespace ZmqTransport
+{
+    /** Transports, in the order of the editors' selectors */
+    enum Type
+    {
+        TCP = 0,
+        IPC,
+        INPROC,
+        SHARED_MEMORY   // not a ZeroMQ endpoint: packets go through a SharedMemoryRing instead
+    };
+
+    /** Topics of spike and text packets; continuous packets use their stream name in multi-stream mode */
+    const char* const SPIKE_TOPIC = "spikes";
+    const char* const MESSAGE_TOPIC = "messages";
+
+    /** Endpoint a publisher binds to */
+    std::string getBindEndpoint(Type type, int port, const std::string& ipcPath);
+
+    /** Endpoint a subscriber connects to */
+    std::string getConnectEndpoint(Type type, const std::string& address, int port, const std::string& ipcPath);
+
+    /** Process-wide context for inproc sockets; never destroyed */
+    void* getSharedContext();
+
+    /**
+        Advanced socket settings, exposed in the Socket panel of both editors.
+
+        The defaults are those of ZeroMQ, so they change nothing unless edited.
+    */
+    struct SocketOptions
+    {
+        int highWaterMark = 1000;   // ZMQ_SNDHWM / ZMQ_RCVHWM: messages queued per peer before new ones are dropped (0 = no limit)
+        int bufferSize = 0;         // ZMQ_SNDBUF / ZMQ_RCVBUF: kernel buffer in bytes (0 = OS default)
+        int ioThreads = 1;          // ZMQ_IO_THREADS of the context
+        uint64_t affinity = 0;      // ZMQ_AFFINITY: bitmask of the I/O threads that serve the socket (0 = any)
+        bool conflate = false;      // ZMQ_CONFLATE: only keep the latest message (single-stream only)
+        bool tcpKeepalive = false;  // ZMQ_TCP_KEEPALIVE, to detect dead peers on long-lived tcp connections
+
+        bool operator==(const SocketOptions& other) const;
+        bool operator!=(const SocketOptions& other) const { return !(*this == other); }
+    };
+
+    /** Creates a context with the I/O threads of the options */
+    void* createContext(const SocketOptions& options);
+
+    /** Sets the options on a socket, before it binds or connects; send selects the SND or RCV variants */
+    void applySocketOptions(void* socket, const SocketOptions& options, bool send);
+}
+
+#endif  // ZMQTRANSPORT_H_INCLUDED
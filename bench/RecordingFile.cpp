@@ -0,0 +1,287 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "RecordingFile.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char FILE_MAGIC[8] = { 'F', 'A', 'L', 'C', 'R', 'E', 'C', '\0' };
+    const uint32_t FILE_VERSION = 1;
+
+    /** Frames start on 8-byte boundaries, so that their headers and packets stay aligned */
+    size_t roundUp(size_t bytes)
+    {
+        return (bytes + 7) & ~size_t(7);
+    }
+}
+
+struct alignas(64) RecordingFile::Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t clock;
+    uint64_t frameCount;
+    uint64_t dataSize;      // bytes of frames after the header
+};
+
+namespace
+{
+    struct FrameHeader
+    {
+        uint64_t receiveNs;
+        uint32_t topicSize;
+        uint32_t packetSize;
+    };
+}
+
+RecordingFile::RecordingFile()
+    : fd(-1), header(nullptr), mappedBytes(0), isWriter(false), readOffset(0)
+{
+}
+
+RecordingFile::~RecordingFile()
+{
+    close();
+}
+
+int RecordingFile::getClock() const
+{
+    return header != nullptr ? int(header->clock) : 0;
+}
+
+uint64_t RecordingFile::getFrameCount() const
+{
+    return header != nullptr ? header->frameCount : 0;
+}
+
+uint64_t RecordingFile::getDataSize() const
+{
+    return header != nullptr ? header->dataSize : 0;
+}
+
+bool RecordingFile::next(Frame& frame)
+{
+    if (header == nullptr || readOffset + sizeof(FrameHeader) > header->dataSize)
+        return false;
+
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(header) + sizeof(Header) + readOffset;
+
+    FrameHeader frameHeader;
+    memcpy(&frameHeader, data, sizeof(frameHeader));
+
+    const size_t size = roundUp(sizeof(FrameHeader) + frameHeader.topicSize + frameHeader.packetSize);
+
+    if (readOffset + size > header->dataSize)
+        return false;
+
+    frame.receiveNs = frameHeader.receiveNs;
+    frame.topic = data + sizeof(FrameHeader);
+    frame.topicSize = frameHeader.topicSize;
+    frame.packet = frame.topic + frameHeader.topicSize;
+    frame.packetSize = frameHeader.packetSize;
+
+    readOffset += size;
+    return true;
+}
+
+#ifdef _WIN32
+
+bool RecordingFile::create(const std::string&, int)
+{
+    return false;
+}
+
+bool RecordingFile::append(uint64_t, const void*, size_t, const void*, size_t)
+{
+    return false;
+}
+
+bool RecordingFile::open(const std::string&)
+{
+    return false;
+}
+
+void RecordingFile::close()
+{
+}
+
+bool RecordingFile::map(size_t, bool)
+{
+    return false;
+}
+
+void RecordingFile::unmap()
+{
+}
+
+#else
+
+bool RecordingFile::map(size_t bytes, bool writer)
+{
+    void* address = mmap(nullptr, bytes, writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+    if (address == MAP_FAILED)
+        return false;
+
+#ifdef MADV_SEQUENTIAL
+    // Frames are written and replayed in order; the kernel can read ahead and drop pages behind
+    madvise(address, bytes, MADV_SEQUENTIAL);
+#endif
+
+    header = static_cast<Header*>(address);
+    mappedBytes = bytes;
+    isWriter = writer;
+
+    return true;
+}
+
+void RecordingFile::unmap()
+{
+    if (header != nullptr)
+        munmap(header, mappedBytes);
+
+    header = nullptr;
+    mappedBytes = 0;
+}
+
+bool RecordingFile::create(const std::string& path, int clock)
+{
+    close();
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+        return false;
+
+    if (ftruncate(fd, off_t(GROWTH)) != 0 || !map(GROWTH, true))
+    {
+        close();
+        return false;
+    }
+
+    // ftruncate() zero-fills the file, so only the non-zero fields are set
+    header->version = FILE_VERSION;
+    header->clock = uint32_t(clock);
+    memcpy(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+
+    return true;
+}
+
+bool RecordingFile::append(uint64_t receiveNs, const void* topic, size_t topicSize, const void* packet, size_t packetSize)
+{
+    if (header == nullptr || !isWriter)
+        return false;
+
+    const size_t size = roundUp(sizeof(FrameHeader) + topicSize + packetSize);
+    const uint64_t offset = header->dataSize;
+
+    if (sizeof(Header) + offset + size > mappedBytes)
+    {
+        // Grow in large steps, so that remapping stays rare compared to the frames written
+        const size_t bytes = mappedBytes + (size > GROWTH ? roundUp(size) + GROWTH : GROWTH);
+
+        unmap();
+
+        if (ftruncate(fd, off_t(bytes)) != 0 || !map(bytes, true))
+            return false;
+    }
+
+    uint8_t* data = reinterpret_cast<uint8_t*>(header) + sizeof(Header) + offset;
+
+    FrameHeader frameHeader;
+    frameHeader.receiveNs = receiveNs;
+    frameHeader.topicSize = uint32_t(topicSize);
+    frameHeader.packetSize = uint32_t(packetSize);
+
+    memcpy(data, &frameHeader, sizeof(frameHeader));
+
+    if (topicSize > 0)
+        memcpy(data + sizeof(FrameHeader), topic, topicSize);
+
+    memcpy(data + sizeof(FrameHeader) + topicSize, packet, packetSize);
+
+    // The frame is complete before the header counts it
+    header->dataSize = offset + size;
+    header->frameCount++;
+
+    return true;
+}
+
+bool RecordingFile::open(const std::string& path)
+{
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+
+    struct stat info;
+
+    if (fd < 0 || fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(Header) || !map(size_t(info.st_size), false))
+    {
+        close();
+        return false;
+    }
+
+    if (memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header->version != FILE_VERSION
+        || sizeof(Header) + header->dataSize > mappedBytes)
+    {
+        close();
+        return false;
+    }
+
+    readOffset = 0;
+    return true;
+}
+
+void RecordingFile::close()
+{
+    const uint64_t usedBytes = header != nullptr && isWriter ? sizeof(Header) + header->dataSize : 0;
+
+    unmap();
+
+    if (fd >= 0)
+    {
+        // Drop the unused end of the last growth step; the frames are intact either way
+        if (usedBytes > 0 && ftruncate(fd, off_t(usedBytes)) != 0)
+            std::fprintf(stderr, "Could not trim the recording: %s\n", std::strerror(errno));
+
+        ::close(fd);
+    }
+
+    fd = -1;
+    isWriter = false;
+    readOffset = 0;
+}
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef RECORDINGFILE_H_INCLUDED
+#define RECORDINGFILE_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+    Append-only file of the frames published by a Falcon Output, written by
+    falcon_record and read back by falcon_replay.
+
+    Each frame holds its receive time in nanoseconds of the recording's host
+    clock, the topic frame that preceded it (possibly empty) and the packet
+    exactly as it was received. The file is memory-mapped in both roles: the
+    writer grows it in large steps and keeps the header up to date after every
+    frame, so a recording interrupted by a crash stays readable up to its last
+    complete frame; close() trims the unused end. Not available on Windows.
+*/
+class RecordingFile
+{
+public:
+
+    /** Bytes added to the file whenever the writer runs out of room */
+    static const size_t GROWTH = size_t(256) << 20;
+
+    /** One recorded frame; the pointers stay valid until the file is closed */
+    struct Frame
+    {
+        uint64_t receiveNs = 0;
+        const uint8_t* topic = nullptr;
+        size_t topicSize = 0;
+        const uint8_t* packet = nullptr;
+        size_t packetSize = 0;
+    };
+
+    /** Constructor */
+    RecordingFile();
+
+    /** Destructor; closes the file */
+    ~RecordingFile();
+
+    /** Creates (or truncates) a file as its writer; clock is the HostClock::Type of the receive times */
+    bool create(const std::string& path, int clock);
+
+    /** Appends a frame; returns false if the file cannot grow */
+    bool append(uint64_t receiveNs, const void* topic, size_t topicSize, const void* packet, size_t packetSize);
+
+    /** Maps an existing file as a reader */
+    bool open(const std::string& path);
+
+    /** Returns the next frame in order, or false at the end of the file */
+    bool next(Frame& frame);
+
+    /** Starts reading again from the first frame */
+    void rewind() { readOffset = 0; }
+
+    /** Unmaps the file; the writer first trims it to its frames */
+    void close();
+
+    /** HostClock::Type of the receive times */
+    int getClock() const;
+
+    /** Number of frames written or available */
+    uint64_t getFrameCount() const;
+
+    /** Bytes of frame data, excluding the file header */
+    uint64_t getDataSize() const;
+
+    struct Header;
+
+private:
+
+    bool map(size_t bytes, bool writer);
+    void unmap();
+
+    int fd;
+    Header* header;
+    size_t mappedBytes;
+    bool isWriter;
+    uint64_t readOffset;
+};
+
+#endif  // RECORDINGFILE_H_INCLUDED
@@ -0,0 +1,932 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zmq.h>
+
+#include "ClockSync.h"
+#include "Decimator.h"
+#include "HostClock.h"
+#include "LatencyHistogram.h"
+#include "PacketCodec.h"
+#include "SampleBlockRing.h"
+#include "SampleTranspose.h"
+#include "SharedMemoryRing.h"
+#include "ZmqTransport.h"
+
+const float BIT_VOLTS = 0.195f;
+const int LATENCY_MESSAGES = 2000;
+
+// Every operator new of the process is counted, to check that encoding does not allocate
+static std::atomic<int64_t> allocations(0);
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+// Generates band-limited noise that looks like extracellular data digitized at BIT_VOLTS
+void generateBlock(int nChannels, int nSamples, std::vector<float>& data)
+{
+    std::mt19937 generator(42);
+    std::normal_distribution<float> noise(0.0f, 20.0f);
+
+    data.resize(size_t(nChannels) * nSamples);
+
+    for (int ch = 0; ch < nChannels; ch++)
+    {
+        float value = 0.0f;
+
+        for (int i = 0; i < nSamples; i++)
+        {
+            value = 0.9f * value + noise(generator);
+            data[size_t(ch) * nSamples + i] = std::nearbyint(value / BIT_VOLTS) * BIT_VOLTS;
+        }
+    }
+}
+
+double elapsedMicroseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+struct FormatCase
+{
+    const char* name;
+    PacketFormat format;
+};
+
+/**
+    Encodes blocks with the same PacketEncoder as Falcon Output and decodes them
+    with the same PacketDecoder as Falcon Input, for every format and size.
+*/
+void benchmarkPackets()
+{
+    std::vector<FormatCase> cases(6);
+    cases[0].name = "float32";
+    cases[1].name = "float32-sm";
+    cases[1].format.sampleMajor = true;
+    cases[2].name = "int16";
+    cases[2].format.int16Samples = true;
+    cases[3].name = "int16-sm";
+    cases[3].format.int16Samples = true;
+    cases[3].format.sampleMajor = true;
+    cases[4].name = "f32-delta";
+    cases[4].format.compressed = true;
+    cases[5].name = "i16-delta";
+    cases[5].format.int16Samples = true;
+    cases[5].format.compressed = true;
+
+    std::printf("Packet encode (Falcon Output) and decode (Falcon Input), transpose kernel: %s\n", SampleTranspose::getKernelName());
+    std::printf("MB/s counts float32 input samples; latencies are per block, in us\n");
+    std::printf("%-10s %8s %8s %6s | %9s %9s %9s %9s | %9s %9s %9s\n", "format", "channels", "samples", "ratio",
+                "enc MB/s", "blocks/s", "p50", "p99", "dec MB/s", "p50", "p99");
+
+    for (int nChannels : { 16, 64, 384, 1024, 5000 })
+    {
+        for (int nSamples : { 64, 256, 1024 })
+        {
+            std::vector<float> data;
+            generateBlock(nChannels, nSamples, data);
+
+            std::vector<const float*> channels(nChannels);
+            for (int ch = 0; ch < nChannels; ch++)
+                channels[ch] = data.data() + size_t(ch) * nSamples;
+
+            std::vector<float> bitVolts(nChannels, BIT_VOLTS);
+            std::vector<uint16_t> eventCodes(nSamples, 0);
+            std::vector<float> decoded(data.size());
+
+            PacketEvents events;
+            events.codes = eventCodes.data();
+
+            const double blockBytes = double(data.size()) * sizeof(float);
+            const int repetitions = std::max(10, std::min(1000, int(50.0e6 / double(data.size()))));
+
+            for (const FormatCase& c : cases)
+            {
+                PacketEncoder encoder;
+                PacketDecoder decoder;
+                LatencyHistogram encodeLatency;
+                LatencyHistogram decodeLatency;
+                double encodeTotal = 0.0;
+                double decodeTotal = 0.0;
+                size_t packetSize = 0;
+
+                for (int r = -1; r < repetitions; r++)  // the first run only warms up
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    encoder.encode(c.format, channels.data(), nChannels, nSamples, bitVolts.data(), events,
+                                   "bench", uint64_t(r) * nSamples, PacketTimes(), uint64_t(r + 1), 30000);
+                    auto encoded = std::chrono::steady_clock::now();
+
+                    flatbuffers::FlatBufferBuilder& builder = encoder.getBuilder();
+                    packetSize = builder.GetSize();
+                    decoder.decode(openephysflatbuffer::GetContinuousData(builder.GetBufferPointer()), decoded.data(), nChannels);
+                    auto end = std::chrono::steady_clock::now();
+
+                    builder.Clear();
+
+                    if (r < 0)
+                        continue;
+
+                    encodeLatency.record(elapsedMicroseconds(start, encoded));
+                    decodeLatency.record(elapsedMicroseconds(encoded, end));
+                    encodeTotal += elapsedMicroseconds(start, encoded);
+                    decodeTotal += elapsedMicroseconds(encoded, end);
+                }
+
+                // Decoded samples are interleaved; int16 formats are exact here because the data is on the ADC grid
+                bool matches = true;
+
+                for (int ch = 0; ch < nChannels && matches; ch++)
+                    for (int i = 0; i < nSamples && matches; i++)
+                        matches = std::fabs(decoded[size_t(i) * nChannels + ch] - channels[ch][i]) <= 1.0e-3f;
+
+                const double encodeMean = encodeTotal / repetitions;
+                const double decodeMean = decodeTotal / repetitions;
+
+                std::printf("%-10s %8d %8d %6.2f | %9.0f %9.0f %9.1f %9.1f | %9.0f %9.1f %9.1f%s\n",
+                            c.name, nChannels, nSamples, blockBytes / packetSize,
+                            blockBytes / encodeMean, 1.0e6 / encodeMean,
+                            encodeLatency.getPercentile(50.0), encodeLatency.getPercentile(99.0),
+                            blockBytes / decodeMean,
+                            decodeLatency.getPercentile(50.0), decodeLatency.getPercentile(99.0),
+                            matches ? "" : "  MISMATCH");
+            }
+        }
+    }
+}
+
+/** Round trip of sparse TTL events, including lines above 15; returns false on any difference */
+bool checkSparseEvents()
+{
+    const int nSamples = 64;
+    std::vector<float> data(nSamples, 0.0f);
+    const float* channels[] = { data.data() };
+    const float bitVolts[] = { BIT_VOLTS };
+
+    const openephysflatbuffer::TtlEvent changes[] = {
+        openephysflatbuffer::TtlEvent(0, 3, false),
+        openephysflatbuffer::TtlEvent(10, 40, true),
+        openephysflatbuffer::TtlEvent(10, 0, true),
+        openephysflatbuffer::TtlEvent(63, 40, false)
+    };
+
+    PacketEvents events;
+    events.ttlWord = uint64_t(1) << 3;
+    events.ttlEvents = changes;
+    events.numTtlEvents = 4;
+
+    PacketEncoder encoder;
+    PacketDecoder decoder;
+    std::vector<uint64_t> words(nSamples);
+
+    encoder.encode(PacketFormat(), channels, 1, nSamples, bitVolts, events, "bench", 0, PacketTimes(), 1, 30000);
+    decoder.decodeEvents(openephysflatbuffer::GetContinuousData(encoder.getBuilder().GetBufferPointer()), words.data());
+
+    bool ok = true;
+
+    for (int i = 0; i < nSamples; i++)
+    {
+        const uint64_t expected = i < 10 ? 0 : (i < 63 ? (uint64_t(1) << 40) | 1 : 1);
+        ok = ok && words[i] == expected;
+    }
+
+    // Without any change, the packet carries no event vector at all
+    events.numTtlEvents = 0;
+    encoder.encode(PacketFormat(), channels, 1, nSamples, bitVolts, events, "bench", 0, PacketTimes(), 2, 30000);
+    ok = ok && openephysflatbuffer::GetContinuousData(encoder.getBuilder().GetBufferPointer())->ttl_events() == nullptr;
+
+    std::printf("\nSparse TTL events round trip: %s\n", ok ? "OK" : "MISMATCH");
+
+    return ok;
+}
+
+/** Round trip of the packet timestamps, and cost of reading each host clock; returns false on any difference */
+bool checkTimestamps()
+{
+    const int nSamples = 64;
+    std::vector<float> data(nSamples, 0.0f);
+    const float* channels[] = { data.data() };
+    const float bitVolts[] = { BIT_VOLTS };
+    const char* names[] = { "steady", "monotonic_raw", "tai" };
+
+    PacketEncoder encoder;
+    bool ok = true;
+
+    std::printf("\nHost clocks (ns per read):");
+
+    for (int type = HostClock::STEADY; type <= HostClock::TAI; type++)
+    {
+        const HostClock::Type clock = HostClock::Type(type);
+
+        if (!HostClock::isAvailable(clock))
+        {
+            std::printf(" %s n/a", names[type]);
+            continue;
+        }
+
+        const int reads = 100000;
+        uint64_t previous = HostClock::nowNanoseconds(clock);
+        const uint64_t first = previous;
+
+        for (int i = 0; i < reads; i++)
+        {
+            const uint64_t now = HostClock::nowNanoseconds(clock);
+            ok = ok && now >= previous;
+            previous = now;
+        }
+
+        std::printf(" %s %.1f", names[type], double(previous - first) / reads);
+
+        PacketTimes times;
+        times.timestamp = 12.5;
+        times.clock = openephysflatbuffer::TimestampClock(type);
+        times.timestampNs = first;
+        times.enqueuedNs = first + 1000;
+        times.sentNs = previous;
+        times.hardwareTimestamp = 3.25;
+
+        encoder.encode(PacketFormat(), channels, 1, nSamples, bitVolts, PacketEvents(), "bench", 0, times, 1, 30000);
+        auto packet = openephysflatbuffer::GetContinuousData(encoder.getBuilder().GetBufferPointer());
+
+        ok = ok && packet->timestamp() == times.timestamp && packet->clock() == times.clock
+                && packet->timestamp_ns() == times.timestampNs && packet->enqueued_ns() == times.enqueuedNs
+                && packet->sent_ns() == times.sentNs && packet->hardware_timestamp() == times.hardwareTimestamp;
+
+        // Falcon Output overwrites sent_ns in the finished packet just before sending it
+        auto sent = openephysflatbuffer::GetMutableContinuousData(encoder.getBuilder().GetBufferPointer());
+        ok = ok && sent->mutate_sent_ns(previous + 500) && packet->sent_ns() == previous + 500
+                && packet->enqueued_ns() == times.enqueuedNs;
+    }
+
+    // Without a hardware timestamp, the field is left out and reads as -1
+    encoder.encode(PacketFormat(), channels, 1, nSamples, bitVolts, PacketEvents(), "bench", 0, PacketTimes(), 2, 30000);
+    ok = ok && openephysflatbuffer::GetContinuousData(encoder.getBuilder().GetBufferPointer())->hardware_timestamp() == -1.0;
+
+    // Decimated by 30 from 30 kHz, as Falcon Output sends it: timestamp is the arrival of the last
+    // input sample, and timestamp - last_sample_age the time of the input sample the last output shows
+    const int factor = 30;
+    const double inputRate = 30000.0;
+    Decimator decimator;
+    decimator.reset(factor, 1, 1024);
+
+    std::vector<float> input(1024, 0.0f), decimated(1024 / factor + 1);
+    const float* inputChannels[] = { input.data() };
+    double worstError = 0.0, minAge = 1.0, maxAge = 0.0;
+
+    for (int64_t sampleNum = 0, i = 0; sampleNum < 30000; sampleNum += 250 + (i * 37) % 700, i++)
+    {
+        const int numSamples = 250 + int((i * 37) % 700);
+        const int64_t firstOutput = decimator.getOutputSampleNumber(sampleNum);
+        const int numOutputs = decimator.process(inputChannels, numSamples, sampleNum, decimated.data(), 0);
+
+        if (numOutputs == 0)
+            continue;
+
+        PacketTimes times;
+        times.timestamp = 100.0 + double(sampleNum + numSamples - 1) / inputRate;
+        times.lastSampleAge = double(decimator.getLastOutputAge(sampleNum, numSamples)) / inputRate;
+
+        encoder.encode(PacketFormat(), inputChannels, 1, numOutputs, bitVolts, PacketEvents(), "bench",
+                       uint64_t(firstOutput), times, uint64_t(i + 3), uint32_t(inputRate) / factor);
+        auto packet = openephysflatbuffer::GetContinuousData(encoder.getBuilder().GetBufferPointer());
+
+        // Falcon Input dates the last sample at timestamp - last_sample_age
+        const double lastSample = packet->timestamp() - packet->last_sample_age();
+        const double shown = 100.0 + double((packet->sample_num() + packet->n_samples() - 1) * factor) / inputRate;
+
+        worstError = std::max(worstError, std::abs(lastSample - shown));
+        minAge = std::min(minAge, packet->last_sample_age());
+        maxAge = std::max(maxAge, packet->last_sample_age());
+    }
+
+    // The filter delay, plus up to factor - 1 input samples after the last kept one
+    const double delay = double(decimator.getDelay() * factor) / inputRate;
+    ok = ok && worstError < 1.0e-9 && minAge >= delay - 1.0e-9 && maxAge < delay + factor / inputRate;
+
+    std::printf("\nDecimated timestamps: last sample %.2f to %.2f ms before timestamp, worst error %.1e s\n",
+                minAge * 1000.0, maxAge * 1000.0, worstError);
+
+    std::printf("Packet timestamps round trip: %s\n", ok ? "OK" : "MISMATCH");
+
+    return ok;
+}
+
+/**
+    Checks the decimation filter of Falcon Output (pass band, rejection of what would alias,
+    independence from the block sizes, alignment of the samples and TTL events after the
+    filter delay) and times it for 384 channels. Returns false on failure.
+*/
+bool checkDecimation()
+{
+    const int sampleRate = 30000;
+    const int factor = 30;
+    const int nSamples = 3 * sampleRate;
+
+    // Gain for a tone: RMS of the second half of the output (after the filter has settled), times sqrt(2)
+    auto toneGain = [&](double frequency)
+    {
+        std::vector<float> tone(nSamples);
+
+        for (int i = 0; i < nSamples; i++)
+            tone[i] = float(std::sin(2.0 * 3.14159265358979323846 * frequency * i / sampleRate));
+
+        Decimator decimator;
+        decimator.reset(factor, 1, 1024);
+
+        std::vector<float> out(nSamples / factor);
+        int numOutputs = 0;
+
+        for (int start = 0; start < nSamples; start += 1024)
+        {
+            const float* channel[] = { tone.data() + start };
+            const int count = std::min(1024, nSamples - start);
+            numOutputs += decimator.process(channel, count, start, out.data() + numOutputs, count);
+        }
+
+        double power = 0.0;
+
+        for (int j = numOutputs / 2; j < numOutputs; j++)
+            power += double(out[j]) * out[j];
+
+        return std::sqrt(2.0 * power / (numOutputs - numOutputs / 2));
+    };
+
+    const double passGain = toneGain(100.0);
+    const double stopGain = toneGain(1234.0);
+
+    // The same signal in irregular blocks gives the same samples
+    std::vector<float> data;
+    generateBlock(1, 20000, data);
+
+    Decimator whole, pieces;
+    whole.reset(factor, 1, 20000);
+    pieces.reset(factor, 1, 64);
+
+    std::vector<float> expected(20000 / factor + 1), actual(20000 / factor + 1);
+    const float* all[] = { data.data() };
+    const int expectedCount = whole.process(all, 20000, 7, expected.data(), 0);
+
+    const int sizes[] = { 1, 29, 31, 64, 1000, 37, 2048 };
+    int actualCount = 0;
+
+    for (int position = 0, i = 0; position < 20000; position += sizes[i % 7], i++)
+    {
+        const float* channel[] = { data.data() + position };
+        const int count = std::min(sizes[i % 7], 20000 - position);
+        actualCount += pieces.process(channel, count, 7 + position, actual.data() + actualCount, 0);
+    }
+
+    bool sameBlocks = actualCount == expectedCount;
+
+    for (int j = 0; j < expectedCount && sameBlocks; j++)
+        sameBlocks = std::fabs(actual[j] - expected[j]) <= 1.0e-5f;
+
+    // A step and a TTL change at the same input sample reach the same output sample number,
+    // and the output sample numbers run on from 0 without a gap
+    const int stepSample = 10007;
+    std::vector<float> step(20000);
+    std::vector<uint16_t> codes(20000);
+
+    for (int i = 0; i < 20000; i++)
+    {
+        step[i] = i >= stepSample ? 1.0f : 0.0f;
+        codes[i] = i >= stepSample ? 1 : 0;
+    }
+
+    Decimator aligned;
+    aligned.reset(factor, 1, 64);
+
+    std::vector<float> filtered(2048 / factor + 1);
+    int64_t nextOutput = 0, stepOutput = -1, codeOutput = -1, eventOutput = -1;
+    bool contiguous = true;
+
+    for (int position = 0, i = 0; position < 20000; position += sizes[i % 7], i++)
+    {
+        const float* channel[] = { step.data() + position };
+        const int count = std::min(sizes[i % 7], 20000 - position);
+        const int64_t firstOutput = aligned.getOutputSampleNumber(position);
+        const int numOutputs = aligned.process(channel, count, position, filtered.data(), 0);
+
+        aligned.processCodes(codes.data() + position, count, position);
+
+        if (position <= stepSample && stepSample < position + count)
+            aligned.addEvent(stepSample, 3, true);
+
+        if (numOutputs == 0)
+            continue;
+
+        contiguous = contiguous && firstOutput == nextOutput;
+        nextOutput = firstOutput + numOutputs;
+
+        for (int j = 0; j < numOutputs; j++)
+        {
+            if (stepOutput < 0 && filtered[j] >= 0.5f)
+                stepOutput = firstOutput + j;
+
+            if (codeOutput < 0 && codes[position + j] != 0)
+                codeOutput = firstOutput + j;
+        }
+
+        Decimator::Event event;
+
+        while (aligned.takeEvent(nextOutput, event))
+            eventOutput = event.sampleNumber;
+    }
+
+    const bool alignedEvents = contiguous && stepOutput == (stepSample + factor - 1) / factor
+                               && codeOutput == stepOutput && eventOutput == stepOutput;
+
+    // Throughput on a Neuropixels-sized block
+    const int nChannels = 384;
+    const int blockSamples = 1024;
+    std::vector<float> block;
+    generateBlock(nChannels, blockSamples, block);
+
+    std::vector<const float*> channels(nChannels);
+    for (int ch = 0; ch < nChannels; ch++)
+        channels[ch] = block.data() + size_t(ch) * blockSamples;
+
+    Decimator decimator;
+    decimator.reset(factor, nChannels, blockSamples);
+    std::vector<float> out(size_t(nChannels) * (blockSamples / factor + 1));
+
+    const int blocks = 200;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int b = 0; b < blocks; b++)
+        decimator.process(channels.data(), blockSamples, int64_t(b) * blockSamples, out.data(), blockSamples / factor + 1);
+
+    const double perBlock = elapsedMicroseconds(start, std::chrono::steady_clock::now()) / blocks;
+
+    const bool ok = passGain > 0.99 && passGain < 1.01 && stopGain < 1.0e-3 && sameBlocks && alignedEvents;
+
+    std::printf("\nDecimation by %d: gain %.4f at 100 Hz, %.1e at 1234 Hz, block sizes %s, "
+                "step/code/event at output %lld/%lld/%lld, %.1f us per %dx%d block: %s\n",
+                factor, passGain, stopGain, sameBlocks ? "match" : "differ",
+                (long long) stepOutput, (long long) codeOutput, (long long) eventOutput,
+                perBlock, nChannels, blockSamples, ok ? "OK" : "FAILED");
+
+    return ok;
+}
+
+/**
+    Feeds ClockSync with a simulated sender clock (offset, 50 ppm drift) and transit delays
+    with occasional bursts, as Falcon Input does, and checks the estimated drift and mapping.
+*/
+bool checkClockSync()
+{
+    const double offset = 1234.5;
+    const double drift = 50.0e-6;
+    const double minDelay = 100.0e-6;
+
+    std::mt19937 random(7);
+    std::exponential_distribution<double> jitter(1.0 / 50.0e-6);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    ClockSync clock;
+    double worstError = 0.0;
+
+    // 20 s of packets every 34 ms (1024 samples at 30 kHz)
+    for (int packet = 0; packet < 600; packet++)
+    {
+        const double senderTime = 100.0 + packet * 0.0341;
+        const double trueLocal = offset + senderTime * (1.0 + drift);
+        double delay = minDelay + jitter(random);
+
+        // One packet in ten waits behind a burst
+        if (uniform(random) < 0.1)
+            delay += 5.0e-3 * uniform(random);
+
+        clock.addPair(senderTime, trueLocal + delay);
+
+        if (packet >= ClockSync::WINDOW)
+            worstError = std::max(worstError, std::fabs(clock.toLocal(senderTime) - trueLocal));
+    }
+
+    // The estimate follows the least delayed packets, so the mapping is late by about the minimum delay
+    const bool ok = std::fabs(clock.getDriftPpm() - 50.0) < 5.0 && worstError < 500.0e-6;
+
+    std::printf("\nClock sync: drift %.1f ppm (true 50.0), jitter %.0f us, worst mapping error %.0f us: %s\n",
+                clock.getDriftPpm(), clock.getJitterMicroseconds(), worstError * 1.0e6, ok ? "OK" : "FAILED");
+
+    return ok;
+}
+
+/**
+    Counts the heap allocations of PacketEncoder in steady state, as Falcon Output uses it:
+    reserved at start, then blocks encoded and lent to the transport (zero copy) or cleared.
+    Returns false if any block allocates.
+*/
+bool checkAllocations()
+{
+    const int nChannels = 384;
+    const int nSamples = 1024;
+    const int blocks = 200;
+
+    std::vector<float> data;
+    generateBlock(nChannels, nSamples, data);
+
+    std::vector<const float*> channels(nChannels);
+    for (int ch = 0; ch < nChannels; ch++)
+        channels[ch] = data.data() + size_t(ch) * nSamples;
+
+    std::vector<float> bitVolts(nChannels, BIT_VOLTS);
+    std::vector<uint16_t> eventCodes(nSamples, 0);
+    const std::string stream = "example_data";
+
+    PacketEvents events;
+    events.codes = eventCodes.data();
+
+    std::vector<PacketFormat> formats(4);
+    formats[1].int16Samples = true;
+    formats[2].sampleMajor = true;
+    formats[3].int16Samples = true;
+    formats[3].compressed = true;
+
+    std::printf("\nHeap allocations per block in steady state (%d channels x %d samples)\n", nChannels, nSamples);
+    std::printf("%-10s %12s %12s\n", "format", "cleared", "zero copy");
+
+    const char* names[] = { "float32", "int16", "float32-sm", "i16-delta" };
+    bool ok = true;
+
+    for (size_t f = 0; f < formats.size(); f++)
+    {
+        PacketEncoder encoder;
+        encoder.reserve(nChannels, nSamples, stream.size());
+
+        int64_t counts[3];
+
+        // Passes: cleared, zero copy while the pool fills up, zero copy
+        for (int pass = 0; pass < 3; pass++)
+        {
+            const bool zeroCopy = pass > 0;
+
+            // Lent packets come back a few blocks later, as they would from the ZMQ I/O thread
+            std::vector<void*> inFlight;
+            inFlight.reserve(blocks);
+
+            const int64_t before = allocations.load();
+
+            for (int i = 0; i < blocks; i++)
+            {
+                encoder.encode(formats[f], channels.data(), nChannels, nSamples, bitVolts.data(), events,
+                               stream, uint64_t(i) * nSamples, PacketTimes(), uint64_t(i + 1), 30000);
+
+                if (zeroCopy)
+                {
+                    inFlight.push_back(encoder.holdPacket());
+
+                    if (inFlight.size() > 3)
+                    {
+                        PacketEncoder::releasePacket(nullptr, inFlight.front());
+                        inFlight.erase(inFlight.begin());
+                    }
+                }
+                else
+                {
+                    encoder.getBuilder().Clear();
+                }
+            }
+
+            counts[pass] = allocations.load() - before;
+
+            for (void* hint : inFlight)
+                PacketEncoder::releasePacket(nullptr, hint);
+        }
+
+        std::printf("%-10s %12.2f %12.2f\n", names[f], double(counts[0]) / blocks, double(counts[2]) / blocks);
+
+        ok = ok && counts[0] == 0 && counts[2] == 0;
+    }
+
+    std::printf("%s\n", ok ? "OK" : "FAILED: encoding allocates in steady state");
+
+    return ok;
+}
+
+/**
+    Counts the heap allocations of the steps Falcon Output takes for every block before encoding
+    (event codes, decimation with its delayed TTL events, copy into the send ring with the side
+    packets), sized as in startAcquisition(). Blocks of varying size up to the reserved one are
+    decimated by 30 and handed to a consumer. Returns false if any block allocates.
+*/
+bool checkBlockAllocations()
+{
+    const int nChannels = 384;
+    const int maxSamples = 1024;
+    const int factor = 30;
+    const int maxTtlEvents = 256;
+    const size_t maxSideBytes = 1 << 20;
+    const int blocks = 2000;
+
+    std::vector<float> data;
+    generateBlock(nChannels, maxSamples, data);
+
+    std::vector<const float*> channels(nChannels);
+    for (int ch = 0; ch < nChannels; ch++)
+        channels[ch] = data.data() + size_t(ch) * maxSamples;
+
+    // Sized once, as in startAcquisition()
+    Decimator decimator;
+    decimator.reset(factor, nChannels, maxSamples);
+
+    std::vector<float> decimated;
+    decimated.reserve(size_t(nChannels) * (maxSamples / factor + 1));
+
+    std::vector<uint16_t> eventCodes;
+    eventCodes.reserve(maxSamples);
+
+    std::vector<openephysflatbuffer::TtlEvent> ttlEvents;
+    ttlEvents.reserve(maxTtlEvents);
+
+    std::vector<uint8_t> pendingSidePackets;
+    pendingSidePackets.reserve(maxSideBytes);
+
+    SampleBlockRing ring;
+    ring.reset(32, nChannels, maxSamples, maxTtlEvents, maxSideBytes);
+
+    std::vector<const float*> outputs(nChannels);
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<int> blockSize(maxSamples / 2, maxSamples);
+    int64_t sampleNum = 0;
+
+    const int64_t before = allocations.load();
+
+    for (int i = 0; i < blocks; i++)
+    {
+        const int numSamples = blockSize(generator);
+
+        eventCodes.resize(numSamples);
+        std::fill(eventCodes.begin(), eventCodes.end(), uint16_t(i & 1));
+        ttlEvents.clear();
+        ttlEvents.push_back(openephysflatbuffer::TtlEvent(uint32_t(numSamples / 2), 0, (i & 1) != 0));
+
+        // A spike packet queued during the block
+        pendingSidePackets.resize(pendingSidePackets.size() + 200);
+
+        const int64_t firstOutput = decimator.getOutputSampleNumber(sampleNum);
+        const int numOutputs = decimator.getNumOutputSamples(sampleNum, numSamples);
+
+        if (decimated.size() < size_t(nChannels) * numOutputs)
+            decimated.resize(size_t(nChannels) * numOutputs);
+
+        decimator.process(channels.data(), numSamples, sampleNum, decimated.data(), numOutputs);
+        decimator.processCodes(eventCodes.data(), numSamples, sampleNum);
+
+        for (const auto& event : ttlEvents)
+            decimator.addEvent(sampleNum + event.sample_offset(), event.line(), event.state());
+
+        ttlEvents.clear();
+        sampleNum += numSamples;
+
+        if (numOutputs == 0)
+            continue;
+
+        for (int ch = 0; ch < nChannels; ch++)
+            outputs[ch] = decimated.data() + size_t(ch) * numOutputs;
+
+        Decimator::Event event;
+
+        while (decimator.takeEvent(firstOutput + numOutputs, event))
+            ttlEvents.push_back(openephysflatbuffer::TtlEvent(uint32_t(event.sampleNumber - firstOutput),
+                                                              uint8_t(event.line), event.state));
+
+        SampleBlock* block = ring.beginWrite();
+
+        block->prepare(nChannels, numOutputs);
+
+        for (int ch = 0; ch < nChannels; ch++)
+            std::memcpy(block->samples.data() + size_t(ch) * numOutputs, outputs[ch], numOutputs * sizeof(float));
+
+        std::memcpy(block->eventCodes.data(), eventCodes.data(), numOutputs * sizeof(uint16_t));
+        block->ttlEvents.assign(ttlEvents.begin(), ttlEvents.end());
+        block->sidePackets.assign(pendingSidePackets.begin(), pendingSidePackets.end());
+        pendingSidePackets.clear();
+        ring.commitWrite();
+
+        // The sender thread takes the block straight away
+        ring.beginRead();
+        ring.commitRead();
+    }
+
+    const int64_t count = allocations.load() - before;
+    const bool ok = count == 0;
+
+    std::printf("\nHeap allocations per block before encoding (%d channels, up to %d samples, decimated by %d): %.2f: %s\n",
+                nChannels, maxSamples, factor, double(count) / blocks, ok ? "OK" : "FAILED");
+
+    return ok;
+}
+
+int64_t nowNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** One-way PUB -> SUB latency within this process; every message carries its send time */
+void benchmarkTransport(ZmqTransport::Type type, const char* name, size_t messageSize)
+{
+    const int port = 5555;
+    const std::string ipcPath = "/tmp/falcon-bench";
+
+    void* context = type == ZmqTransport::INPROC ? ZmqTransport::getSharedContext() : zmq_ctx_new();
+    void* publisher = zmq_socket(context, ZMQ_PUB);
+    void* subscriber = zmq_socket(context, ZMQ_SUB);
+
+    int hwm = 0;
+    zmq_setsockopt(publisher, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+    zmq_setsockopt(subscriber, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+    zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+
+    if (zmq_bind(publisher, ZmqTransport::getBindEndpoint(type, port, ipcPath).c_str())
+        || zmq_connect(subscriber, ZmqTransport::getConnectEndpoint(type, "127.0.0.1", port, ipcPath).c_str()))
+    {
+        std::printf("%-8s %10zu   unavailable (%s)\n", name, messageSize, zmq_strerror(zmq_errno()));
+    }
+    else
+    {
+        // Give the subscription time to reach the publisher
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        std::vector<char> message(messageSize);
+        std::vector<char> received(messageSize);
+        std::vector<double> latencies;
+        latencies.reserve(LATENCY_MESSAGES);
+
+        for (int i = 0; i < LATENCY_MESSAGES; i++)
+        {
+            int64_t sent = nowNanoseconds();
+            memcpy(message.data(), &sent, sizeof(sent));
+            zmq_send(publisher, message.data(), message.size(), 0);
+
+            if (zmq_recv(subscriber, received.data(), received.size(), 0) < int(sizeof(sent)))
+                break;
+
+            memcpy(&sent, received.data(), sizeof(sent));
+            latencies.push_back((nowNanoseconds() - sent) / 1000.0);
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+
+        if (latencies.empty())
+            std::printf("%-8s %10zu   no messages received\n", name, messageSize);
+        else
+            std::printf("%-8s %10zu %12.1f %12.1f\n", name, messageSize,
+                        latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]);
+    }
+
+    int linger = 0;
+    zmq_setsockopt(publisher, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(subscriber, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(subscriber);
+    zmq_close(publisher);
+
+    if (context != ZmqTransport::getSharedContext())
+        zmq_ctx_destroy(context);
+}
+
+/** Same measurement through the shared memory ring, with the reader sleeping on its own thread */
+void benchmarkSharedMemory(size_t messageSize)
+{
+    const std::string name = "/falcon-bench";
+
+    SharedMemoryRing writer;
+    SharedMemoryRing reader;
+
+    if (!writer.create(name, 16, messageSize) || !reader.open(name))
+    {
+        std::printf("%-8s %10zu   unavailable\n", "shm", messageSize);
+        return;
+    }
+
+    std::vector<double> latencies;
+    latencies.reserve(LATENCY_MESSAGES);
+
+    std::thread consumer([&] {
+        while (int(latencies.size()) < LATENCY_MESSAGES)
+        {
+            size_t size;
+            const uint8_t* frame = reader.read(size, 1000);
+
+            if (frame == nullptr)
+                break;
+
+            int64_t sent;
+            memcpy(&sent, frame, sizeof(sent));
+            latencies.push_back((nowNanoseconds() - sent) / 1000.0);
+        }
+    });
+
+    std::vector<char> message(messageSize);
+
+    for (int i = 0; i < LATENCY_MESSAGES; i++)
+    {
+        // Leave the reader time to go back to sleep, as it would between blocks
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+        int64_t sent = nowNanoseconds();
+        memcpy(message.data(), &sent, sizeof(sent));
+        writer.write(message.data(), message.size());
+    }
+
+    consumer.join();
+    writer.close();
+
+    std::sort(latencies.begin(), latencies.end());
+
+    if (latencies.empty())
+        std::printf("%-8s %10zu   no messages received\n", "shm", messageSize);
+    else
+        std::printf("%-8s %10zu %12.1f %12.1f\n", "shm", messageSize,
+                    latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]);
+}
+
+int main(int argc, char** argv)
+{
+    // falcon_bench [packets|allocations|transport] runs a single part
+    const std::string only = argc > 1 ? argv[1] : "";
+    bool ok = true;
+
+    if (only.empty() || only == "packets")
+    {
+        benchmarkPackets();
+        ok = checkSparseEvents();
+        ok = checkTimestamps() && ok;
+        ok = checkDecimation() && ok;
+        ok = checkClockSync() && ok;
+    }
+
+    if (only.empty() || only == "allocations")
+    {
+        ok = checkAllocations() && ok;
+        ok = checkBlockAllocations() && ok;
+    }
+
+    if (only.empty() || only == "transport")
+    {
+        std::printf("\nTransport latency (us, publisher and subscriber in one process)\n");
+        std::printf("%-8s %10s %12s %12s\n", "transport", "bytes", "median", "p99");
+
+        // 64 channels x 16 samples and 384 channels x 1024 samples of float32
+        for (size_t messageSize : { size_t(4096), size_t(1572864) })
+        {
+            benchmarkTransport(ZmqTransport::TCP, "tcp", messageSize);
+            benchmarkTransport(ZmqTransport::IPC, "ipc", messageSize);
+            benchmarkTransport(ZmqTransport::INPROC, "inproc", messageSize);
+            benchmarkSharedMemory(messageSize);
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+// falcon_record [endpoint] file [-s topic]... [-n packets] [-t seconds] [-hwm messages]
+//
+// Subscribes to a Falcon Output and appends every packet it receives, with its topic
+// and receive time, to a recording that falcon_replay can publish again. Records until
+// Ctrl+C, or until the given number of packets or seconds.
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <zmq.h>
+
+#include "HostClock.h"
+#include "RecordingFile.h"
+
+static std::atomic<bool> stopRequested(false);
+
+static void requestStop(int)
+{
+    stopRequested.store(true);
+}
+
+static int usage()
+{
+    std::fprintf(stderr,
+                 "usage: falcon_record [endpoint] file [-s topic]... [-n packets] [-t seconds] [-hwm messages]\n"
+                 "  endpoint  Falcon Output to subscribe to (default tcp://127.0.0.1:3335)\n"
+                 "  -s        only record this topic (stream or group name, spikes, messages); repeatable\n"
+                 "  -n / -t   stop after this many packets / seconds (default: Ctrl+C)\n"
+                 "  -hwm      receive high water mark (default 0: never drop)\n");
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> positional;
+    std::vector<std::string> topics;
+    uint64_t maxPackets = 0;
+    double maxSeconds = 0.0;
+    int highWaterMark = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+
+        if (arg == "-s" && i + 1 < argc)
+            topics.push_back(argv[++i]);
+        else if (arg == "-n" && i + 1 < argc)
+            maxPackets = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "-t" && i + 1 < argc)
+            maxSeconds = std::atof(argv[++i]);
+        else if (arg == "-hwm" && i + 1 < argc)
+            highWaterMark = std::atoi(argv[++i]);
+        else if (arg[0] == '-')
+            return usage();
+        else
+            positional.push_back(arg);
+    }
+
+    if (positional.empty() || positional.size() > 2)
+        return usage();
+
+    const std::string endpoint = positional.size() == 2 ? positional[0] : "tcp://127.0.0.1:3335";
+    const std::string path = positional.back();
+
+    // Receive times come from the raw monotonic clock where there is one, so that NTP does not skew the pacing
+    const HostClock::Type clock = HostClock::isAvailable(HostClock::MONOTONIC_RAW) ? HostClock::MONOTONIC_RAW
+                                                                                     : HostClock::STEADY;
+
+    RecordingFile file;
+
+    if (!file.create(path, clock))
+    {
+        std::fprintf(stderr, "Could not create %s: %s\n", path.c_str(), std::strerror(errno));
+        return 1;
+    }
+
+    void* context = zmq_ctx_new();
+    void* socket = zmq_socket(context, ZMQ_SUB);
+
+    const int timeoutMs = 100;
+    zmq_setsockopt(socket, ZMQ_RCVHWM, &highWaterMark, sizeof(highWaterMark));
+    zmq_setsockopt(socket, ZMQ_RCVTIMEO, &timeoutMs, sizeof(timeoutMs));
+
+    if (topics.empty())
+        zmq_setsockopt(socket, ZMQ_SUBSCRIBE, "", 0);
+
+    for (const auto& topic : topics)
+        zmq_setsockopt(socket, ZMQ_SUBSCRIBE, topic.data(), topic.size());
+
+    if (zmq_connect(socket, endpoint.c_str()))
+    {
+        std::fprintf(stderr, "Could not connect to %s: %s\n", endpoint.c_str(), zmq_strerror(zmq_errno()));
+        zmq_close(socket);
+        zmq_ctx_destroy(context);
+        return 1;
+    }
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    std::printf("Recording %s to %s, Ctrl+C to stop\n", endpoint.c_str(), path.c_str());
+
+    zmq_msg_t message;
+    zmq_msg_init(&message);
+
+    std::vector<uint8_t> topic;
+    const uint64_t start = HostClock::nowNanoseconds(clock);
+    bool topicPending = false;
+    uint64_t firstNs = 0;
+    uint64_t lastNs = 0;
+    bool failed = false;
+
+    while (!stopRequested.load() && (maxPackets == 0 || file.getFrameCount() < maxPackets))
+    {
+        // Checked before receiving, and never between a topic frame and its packet, so that the
+        // last frame received is always written
+        if (!topicPending && maxSeconds > 0.0
+            && double(HostClock::nowNanoseconds(clock) - start) >= maxSeconds * 1.0e9)
+            break;
+
+        const int size = zmq_msg_recv(&message, socket, 0);
+        const uint64_t now = HostClock::nowNanoseconds(clock);
+
+        if (size < 0)
+        {
+            if (zmq_errno() == EAGAIN || zmq_errno() == EINTR)
+                continue;
+
+            std::fprintf(stderr, "Receive failed: %s\n", zmq_strerror(zmq_errno()));
+            failed = true;
+            break;
+        }
+
+        const uint8_t* data = static_cast<const uint8_t*>(zmq_msg_data(&message));
+
+        // A topic frame is kept with the packet that follows it
+        if (zmq_msg_more(&message))
+        {
+            topic.assign(data, data + size);
+            topicPending = true;
+            continue;
+        }
+
+        if (!file.append(now, topic.data(), topic.size(), data, size_t(size)))
+        {
+            std::fprintf(stderr, "Could not write to %s: %s\n", path.c_str(), std::strerror(errno));
+            failed = true;
+            break;
+        }
+
+        topic.clear();
+        topicPending = false;
+
+        if (file.getFrameCount() == 1)
+            firstNs = now;
+
+        lastNs = now;
+    }
+
+    zmq_msg_close(&message);
+
+    const int linger = 0;
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(socket);
+    zmq_ctx_destroy(context);
+
+    const double seconds = double(lastNs - firstNs) * 1.0e-9;
+    const double megabytes = double(file.getDataSize()) / 1.0e6;
+
+    std::printf("%llu packets, %.1f MB in %.1f s (%.1f MB/s)\n", (unsigned long long) file.getFrameCount(),
+                megabytes, seconds, seconds > 0.0 ? megabytes / seconds : 0.0);
+
+    file.close();
+
+    return failed ? 1 : 0;
+}
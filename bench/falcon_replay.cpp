@@ -0,0 +1,221 @@
+/*
+ ------------------------------------------------------------------
+ FalconOutput
+ Copyright (C) 2021 - present Neuro-Electronics Research Flanders
+
+ This file is part of the Open Ephys GUI
+ Copyright (C) 2016 Open Ephys
+ ------------------------------------------------------------------
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+// falcon_replay file [endpoint] [-r rate] [-l loops] [-w ms] [-hwm messages]
+//
+// Publishes a recording made by falcon_record on a PUB socket, each packet after its
+// topic frame, at the pace at which it was recorded (-r 1), faster (-r 10) or as fast
+// as possible (-r 0). Packets are sent straight from the mapped file, without copies.
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zmq.h>
+
+#include "HostClock.h"
+#include "LatencyHistogram.h"
+#include "RecordingFile.h"
+
+static std::atomic<bool> stopRequested(false);
+
+static void requestStop(int)
+{
+    stopRequested.store(true);
+}
+
+static int usage()
+{
+    std::fprintf(stderr,
+                 "usage: falcon_replay file [endpoint] [-r rate] [-l loops] [-w ms] [-hwm messages]\n"
+                 "  endpoint  address to bind (default tcp://*:3335)\n"
+                 "  -r        1 = recorded pace (default), 2 = twice as fast, ..., 0 = as fast as possible\n"
+                 "  -l        number of times the recording is sent (default 1)\n"
+                 "  -w        time given to subscribers to connect before sending (default 1000 ms)\n"
+                 "  -hwm      send high water mark (default 0: never drop)\n");
+    return 2;
+}
+
+/** Waits until the clock reaches target: sleeps while far from it, then spins for precision */
+static void waitUntil(HostClock::Type clock, uint64_t target)
+{
+    const uint64_t spinNs = 200000;
+
+    for (uint64_t now = HostClock::nowNanoseconds(clock); now < target; now = HostClock::nowNanoseconds(clock))
+    {
+        if (target - now > spinNs)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(target - now - spinNs));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> positional;
+    double rate = 1.0;
+    int loops = 1;
+    int waitMs = 1000;
+    int highWaterMark = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+
+        if (arg == "-r" && i + 1 < argc)
+            rate = std::atof(argv[++i]);
+        else if (arg == "-l" && i + 1 < argc)
+            loops = std::atoi(argv[++i]);
+        else if (arg == "-w" && i + 1 < argc)
+            waitMs = std::atoi(argv[++i]);
+        else if (arg == "-hwm" && i + 1 < argc)
+            highWaterMark = std::atoi(argv[++i]);
+        else if (arg[0] == '-')
+            return usage();
+        else
+            positional.push_back(arg);
+    }
+
+    if (positional.empty() || positional.size() > 2 || rate < 0.0 || loops < 1)
+        return usage();
+
+    const std::string path = positional[0];
+    const std::string endpoint = positional.size() == 2 ? positional[1] : "tcp://*:3335";
+
+    RecordingFile file;
+
+    if (!file.open(path))
+    {
+        std::fprintf(stderr, "Could not open %s as a recording: %s\n", path.c_str(), std::strerror(errno));
+        return 1;
+    }
+
+    const HostClock::Type clock = HostClock::Type(file.getClock());
+
+    void* context = zmq_ctx_new();
+    void* socket = zmq_socket(context, ZMQ_PUB);
+
+    zmq_setsockopt(socket, ZMQ_SNDHWM, &highWaterMark, sizeof(highWaterMark));
+
+    if (zmq_bind(socket, endpoint.c_str()))
+    {
+        std::fprintf(stderr, "Could not bind %s: %s\n", endpoint.c_str(), zmq_strerror(zmq_errno()));
+        zmq_close(socket);
+        zmq_ctx_destroy(context);
+        return 1;
+    }
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    std::printf("Replaying %llu packets of %s on %s\n", (unsigned long long) file.getFrameCount(),
+                path.c_str(), endpoint.c_str());
+
+    // PUB drops everything sent before a subscription arrives
+    std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+
+    LatencyHistogram lateness;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+
+    const uint64_t start = HostClock::nowNanoseconds(clock);
+    uint64_t loopStart = start;
+
+    for (int loop = 0; loop < loops && !stopRequested.load(); loop++)
+    {
+        RecordingFile::Frame frame;
+        uint64_t firstNs = 0;
+        bool first = true;
+
+        file.rewind();
+
+        while (!stopRequested.load() && file.next(frame))
+        {
+            if (first)
+            {
+                firstNs = frame.receiveNs;
+                first = false;
+            }
+
+            if (rate > 0.0)
+            {
+                const uint64_t target = loopStart + uint64_t(double(frame.receiveNs - firstNs) / rate);
+                waitUntil(clock, target);
+                lateness.record(double(HostClock::nowNanoseconds(clock) - target) * 1.0e-3);
+            }
+
+            if (frame.topicSize > 0 && zmq_send(socket, frame.topic, frame.topicSize, ZMQ_SNDMORE) < 0)
+            {
+                std::fprintf(stderr, "Send failed: %s\n", zmq_strerror(zmq_errno()));
+                stopRequested.store(true);
+                break;
+            }
+
+            // The mapping outlives the socket, so ZMQ can send from it directly
+            zmq_msg_t message;
+            zmq_msg_init_data(&message, const_cast<uint8_t*>(frame.packet), frame.packetSize, nullptr, nullptr);
+
+            if (zmq_msg_send(&message, socket, 0) < 0)
+            {
+                zmq_msg_close(&message);
+                std::fprintf(stderr, "Send failed: %s\n", zmq_strerror(zmq_errno()));
+                stopRequested.store(true);
+                break;
+            }
+
+            packets++;
+            bytes += frame.packetSize;
+        }
+
+        // Each loop keeps the pace of the recording from its own start
+        loopStart = HostClock::nowNanoseconds(clock);
+    }
+
+    const double seconds = double(HostClock::nowNanoseconds(clock) - start) * 1.0e-9;
+
+    std::printf("%llu packets, %.1f MB in %.2f s (%.0f packets/s, %.1f MB/s)\n", (unsigned long long) packets,
+                double(bytes) / 1.0e6, seconds, seconds > 0.0 ? packets / seconds : 0.0,
+                seconds > 0.0 ? double(bytes) / 1.0e6 / seconds : 0.0);
+
+    if (lateness.getCount() > 0)
+        std::printf("Lateness against the recorded pace (us, p50/p99/p99.9/max): %s\n", lateness.getSummary().c_str());
+
+    // Terminating the context waits until ZMQ is done with the mapped packets (or drops them after Ctrl+C)
+    if (stopRequested.load())
+    {
+        const int linger = 0;
+        zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    }
+
+    zmq_close(socket);
+    zmq_ctx_term(context);
+    file.close();
+
+    return 0;
+}
@@ -25,8 +25,94 @@
 #include <zmq.h>
 #include <iostream>
 #include <string>
+#include <vector>
 #include "channel_generated.h"
 #include "flatbuffers/flatbuffers.h"
+#include "SampleCodec.h"
+#include "SharedMemoryRing.h"
+
+// Copies the samples of a packet into `out` as channel-major floats,
+// whatever the layout and sample format used by the sender
+void getChannelSamples(const openephysflatbuffer::ContinuousData* data, std::vector<float>& out)
+{
+    const size_t n_channels = data->n_channels();
+    const size_t n_samples = data->n_samples();
+    const bool sample_major = data->layout() == openephysflatbuffer::SampleLayout_SampleMajor;
+
+    out.assign(n_channels * n_samples, 0.0f);
+
+    if (data->compression() == openephysflatbuffer::Compression_DeltaBitPack)
+    {
+        if (data->compressed_samples() == nullptr
+            || !SampleCodec::decompress(data->compressed_samples()->data(), data->compressed_samples()->size(),
+                                        n_channels, n_samples,
+                                        data->bit_volts() ? data->bit_volts()->data() : nullptr, out.data()))
+        {
+            std::cout << "Corrupt compressed packet " << data->message_id() << std::endl;
+        }
+
+        return;
+    }
+
+    for (size_t ch = 0; ch < n_channels; ch++)
+    {
+        for (size_t i = 0; i < n_samples; i++)
+        {
+            const size_t index = sample_major ? i * n_channels + ch : ch * n_samples + i;
+
+            if (data->int_samples() && data->bit_volts() && index < data->int_samples()->size())
+                out[ch * n_samples + i] = data->int_samples()->Get(index) * data->bit_volts()->Get(ch);
+            else if (data->samples() && index < data->samples()->size())
+                out[ch * n_samples + i] = data->samples()->Get(index);
+        }
+    }
+}
+
+
+// Prints the header of a packet and decodes its samples
+void processPacket(const openephysflatbuffer::ContinuousData* data, std::vector<float>& samples)
+{
+    std::cout << "Received packet number: " << data->message_id()
+            << ", Stream: " << data->stream()->c_str()
+            << ", Sample_Number: " << data->sample_num()
+            << ", Samples: " << data->n_samples()
+            << ", Channels: " << data->n_channels() << std::endl;
+
+    // Process your data: [sample0/chan0, sample1/chan0, ..., sampleN/chan0, sample0/chan1, sample1/chan1...]
+    getChannelSamples(data, samples);
+
+    // for(auto i = samples.begin(); i < samples.begin() + data->n_samples(); i++)  // Only processing the first channel
+    // {
+    //     std::cout << "Sample Value: " << *i << std::endl;
+    // }
+}
+
+// Reads packets from a Falcon Output using the shm transport on the same host
+int runSharedMemory(int port)
+{
+    SharedMemoryRing ring;
+    ring.open(SharedMemoryRing::getSegmentName(port));
+
+    std::vector<float> samples;
+
+    while(1){
+
+        size_t size;
+        const uint8_t* frame = ring.read(size, 100);  // Sleeps until a packet is published
+
+        if (frame == nullptr)
+            continue;
+
+        flatbuffers::Verifier verifier(frame, size);
+
+        if (!openephysflatbuffer::VerifyContinuousDataBuffer(verifier)) {
+            std::cout << "Impossible to parse the packet received - skipping to the next." << std::endl;
+            continue;
+        }
+
+        processPacket(openephysflatbuffer::GetContinuousData(frame), samples);
+    }
+}
 
 
 int main(int argc, char **argv) {
@@ -34,6 +120,10 @@ int main(int argc, char **argv) {
     // Parameters
     std::string address = "127.0.0.1";
     int port = 3335;
+    bool shared_memory = false;  // Set to true if Falcon Output uses the shm transport
+
+    if (shared_memory)
+        return runSharedMemory(port);
 
     // Step 1: Create your ZMQ socket
     auto context = zmq_ctx_new();
@@ -42,6 +132,8 @@ int main(int argc, char **argv) {
     zmq_setsockopt(socket, ZMQ_SUBSCRIBE, nullptr, 0);
     zmq_connect(socket, tcp_address.c_str());
 
+    std::vector<float> samples;
+
     // Step 2 : Loop to receive packets
     while(1){
 
@@ -52,6 +144,19 @@ int main(int argc, char **argv) {
         if (zmq_msg_recv(&message, socket, ZMQ_DONTWAIT) != -1)  // Non-blocking to wait to receive a message
         {
 
+            // In multi-stream mode, each packet is preceded by a frame holding the stream name
+            if (zmq_msg_more(&message))
+            {
+                std::string topic((const char*)zmq_msg_data(&message), zmq_msg_size(&message));
+
+                if (zmq_msg_recv(&message, socket, 0) == -1)
+                    continue;
+
+                // Spikes and messages (forward_spikes / forward_messages) are not continuous data
+                if (topic == "spikes" || topic == "messages")
+                    continue;
+            }
+
             // Step 3: Decode the message
             try {
                 data = openephysflatbuffer::GetContinuousData(zmq_msg_data(&message));
@@ -61,17 +166,8 @@ int main(int argc, char **argv) {
             }
 
 
-            std::cout << "Received packet number: " << data->message_id()
-                    << ", Stream: " << data->stream()->c_str()
-                    << ", Sample_Number: " << data->sample_num()
-                    << ", Samples: " << data->n_samples()
-                    << ", Channels: " << data->n_channels() << std::endl;
-
-            // Step 4: Process your data: [sample0/chan0, sample1/chan0, ..., sampleN/chan0, sample0/chan1, sample1/chan1...]
-            // for(auto i = data->samples()->begin(); i < data->samples()->begin() + data->n_samples(); i++)  // Only processing the first channel
-            // {
-            //     std::cout << "Sample Value: " << *i << std::endl;
-            // }
+            // Step 4: Process your data
+            processPacket(data, samples);
 
         }
 
@@ -5,6 +5,39 @@ import flatbuffers
 from flatbuffers.compat import import_numpy
 np = import_numpy()
 
+class SampleLayout(object):
+    ChannelMajor = 0
+    SampleMajor = 1
+
+class Compression(object):
+    None_ = 0
+    DeltaBitPack = 1
+
+class TimestampClock(object):
+    Steady = 0
+    MonotonicRaw = 1
+    Tai = 2
+
+COMPRESSION_FRAME = 128
+
+def _unpack_frames(packed, n_channels, n_samples):
+    """Reads the bit-packed residuals of a DeltaBitPack block, as a (n_channels, n_samples) uint32 array."""
+    residuals = np.zeros((n_channels, n_samples), dtype=np.uint32)
+    pos = 0
+    for ch in range(n_channels):
+        for start in range(0, n_samples, COMPRESSION_FRAME):
+            count = min(COMPRESSION_FRAME, n_samples - start)
+            width = int(packed[pos])
+            pos += 1
+            if width == 0:
+                continue
+            n_bytes = (count * width + 7) // 8
+            bits = np.unpackbits(packed[pos:pos + n_bytes], bitorder='little')[:count * width]
+            weights = np.left_shift(np.uint64(1), np.arange(width, dtype=np.uint64))
+            residuals[ch, start:start + count] = bits.reshape((count, width)).astype(np.uint64) @ weights
+            pos += n_bytes
+    return residuals
+
 class ContinuousData(object):
     __slots__ = ['_tab']
 
@@ -100,6 +133,168 @@ class ContinuousData(object):
             return self._tab.Get(flatbuffers.number_types.Uint32Flags, o + self._tab.Pos)
         return 0
 
+    # ContinuousData
+    def Layout(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(22))
+        if o != 0:
+            return self._tab.Get(flatbuffers.number_types.Int8Flags, o + self._tab.Pos)
+        return SampleLayout.ChannelMajor
+
+    # ContinuousData
+    def IntSamplesAsNumpy(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(24))
+        if o != 0:
+            return self._tab.GetVectorAsNumpy(flatbuffers.number_types.Int16Flags, o)
+        return 0
+
+    # ContinuousData
+    def IntSamplesIsNone(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(24))
+        return o == 0
+
+    # ContinuousData
+    def BitVoltsAsNumpy(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(26))
+        if o != 0:
+            return self._tab.GetVectorAsNumpy(flatbuffers.number_types.Float32Flags, o)
+        return 0
+
+    # ContinuousData
+    def Compression(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(28))
+        if o != 0:
+            return self._tab.Get(flatbuffers.number_types.Int8Flags, o + self._tab.Pos)
+        return Compression.None_
+
+    # ContinuousData
+    def CompressedSamplesAsNumpy(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(30))
+        if o != 0:
+            return self._tab.GetVectorAsNumpy(flatbuffers.number_types.Uint8Flags, o)
+        return 0
+
+    # ContinuousData
+    def BitVoltsIsNone(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(26))
+        return o == 0
+
+    # ContinuousData
+    def EventCodesAsNumpy(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(6))
+        if o != 0:
+            return self._tab.GetVectorAsNumpy(flatbuffers.number_types.Uint16Flags, o)
+        return 0
+
+    # ContinuousData
+    def EventCodesIsNone(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(6))
+        return o == 0
+
+    # ContinuousData
+    def TtlWord(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(32))
+        if o != 0:
+            return self._tab.Get(flatbuffers.number_types.Uint64Flags, o + self._tab.Pos)
+        return 0
+
+    # ContinuousData
+    def TtlEvents(self):
+        """Returns the sparse TTL changes as a list of (sample_offset, line, state) tuples."""
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(34))
+        if o == 0:
+            return []
+        a = self._tab.Vector(o)
+        events = []
+        for j in range(self._tab.VectorLen(o)):
+            pos = a + j * 8
+            events.append((self._tab.Get(flatbuffers.number_types.Uint32Flags, pos),
+                           self._tab.Get(flatbuffers.number_types.Uint8Flags, pos + 4),
+                           self._tab.Get(flatbuffers.number_types.BoolFlags, pos + 5)))
+        return events
+
+    # ContinuousData
+    def Clock(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(36))
+        if o != 0:
+            return self._tab.Get(flatbuffers.number_types.Int8Flags, o + self._tab.Pos)
+        return TimestampClock.Steady
+
+    # ContinuousData
+    def TimestampNs(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(38))
+        if o != 0:
+            return self._tab.Get(flatbuffers.number_types.Uint64Flags, o + self._tab.Pos)
+        return 0
+
+    # ContinuousData
+    def EnqueuedNs(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(40))
+        if o != 0:
+            return self._tab.Get(flatbuffers.number_types.Uint64Flags, o + self._tab.Pos)
+        return 0
+
+    # ContinuousData
+    def SentNs(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(42))
+        if o != 0:
+            return self._tab.Get(flatbuffers.number_types.Uint64Flags, o + self._tab.Pos)
+        return 0
+
+    # ContinuousData
+    def HardwareTimestamp(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(44))
+        if o != 0:
+            return self._tab.Get(flatbuffers.number_types.Float64Flags, o + self._tab.Pos)
+        return -1.0
+
+    # ContinuousData
+    def LastSampleAge(self):
+        o = flatbuffers.number_types.UOffsetTFlags.py_type(self._tab.Offset(46))
+        if o != 0:
+            return self._tab.Get(flatbuffers.number_types.Float64Flags, o + self._tab.Pos)
+        return 0.0
+
+    # ContinuousData
+    def EventWordsAsNumpy(self):
+        """Returns the state of the TTL lines (bit n = line n) at every sample, from either event form."""
+        n_samples = self.NSamples()
+        if not self.EventCodesIsNone():
+            return self.EventCodesAsNumpy().astype(np.uint64)
+        words = np.empty(n_samples, dtype=np.uint64)
+        word, start = self.TtlWord(), 0
+        for offset, line, state in self.TtlEvents():
+            offset = min(offset, n_samples)
+            words[start:offset] = word
+            start = offset
+            word = word | (1 << line) if state else word & ~(1 << line)
+        words[start:] = word
+        return words
+
+    # ContinuousData
+    def ChannelSamplesAsNumpy(self):
+        """Returns the samples as a (n_channels, n_samples) float array, whatever the packet layout, sample format and compression."""
+        n_channels, n_samples = self.NChannels(), self.NSamples()
+        if self.Compression() == Compression.DeltaBitPack:
+            residuals = _unpack_frames(self.CompressedSamplesAsNumpy(), n_channels, n_samples)
+            if not self.BitVoltsIsNone():
+                r = residuals.astype(np.int64)
+                deltas = (r >> 1) ^ -(r & 1)
+                return np.cumsum(deltas, axis=1).astype(np.float32) * self.BitVoltsAsNumpy()[:, np.newaxis]
+            return np.bitwise_xor.accumulate(residuals, axis=1).view(np.float32)
+        if not self.IntSamplesIsNone():
+            samples = self.IntSamplesAsNumpy().astype(np.float32)
+            scale = self.BitVoltsAsNumpy()
+        else:
+            samples = self.SamplesAsNumpy()
+            scale = None
+        if self.Layout() == SampleLayout.SampleMajor:
+            samples = samples.reshape((n_samples, n_channels)).T
+        else:
+            samples = samples.reshape((n_channels, n_samples))
+        if scale is not None:
+            samples = samples * scale[:, np.newaxis]
+        return samples
+
 def Start(builder): builder.StartObject(8)
 
 
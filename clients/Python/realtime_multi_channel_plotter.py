@@ -115,7 +115,12 @@ def data_collection():
     while True:
         try:
             # Non-blocking wait to receive a message
-            message = socket.recv(flags=zmq.NOBLOCK)
+            frames = socket.recv_multipart(flags=zmq.NOBLOCK)
+            message = frames[-1]  # last frame, after the optional topic
+
+            # Spikes and messages (forward_spikes / forward_messages) are not continuous data
+            if len(frames) > 1 and frames[0] in (b"spikes", b"messages"):
+                continue
 
             # Decode the message
             try:
@@ -130,14 +135,15 @@ def data_collection():
             # Access fields based on the schema
             num_samples = data.NSamples()
             num_channels = data.NChannels()
-            samples_flat = data.SamplesAsNumpy() * 0.195  # Convert to microvolts
+            samples_flat = data.SamplesAsNumpy() if data.IntSamplesIsNone() else data.IntSamplesAsNumpy()
+            scale = 0.195 if data.IntSamplesIsNone() else 1.0  # Convert to microvolts (int16 packets are rescaled on decoding)
 
             # Check if the total size matches
             total_elements = samples_flat.size
             expected_elements = num_samples * num_channels
 
             if total_elements == expected_elements:
-                samples_reshaped = samples_flat.reshape((num_channels, num_samples))
+                samples_reshaped = data.ChannelSamplesAsNumpy() * scale
 
                 # Update rolling buffer for each channel
                 for i in range(num_channels_to_plot):
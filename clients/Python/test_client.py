@@ -27,7 +27,13 @@ def data_collection():
     while True:
         try:
             # Non-blocking wait to receive a message
-            message = socket.recv(flags=zmq.NOBLOCK)
+            # Multi-stream publishers prefix each packet with a topic frame holding the stream name
+            frames = socket.recv_multipart(flags=zmq.NOBLOCK)
+            message = frames[-1]
+
+            # Spikes and messages (forward_spikes / forward_messages) are not continuous data
+            if len(frames) > 1 and frames[0] in (b"spikes", b"messages"):
+                continue
             
             # Decode the message
             try:
@@ -42,7 +48,7 @@ def data_collection():
             # Access fields based on the schema
             num_samples = data.NSamples()
             num_channels = data.NChannels()
-            samples_flat = data.SamplesAsNumpy()
+            samples_flat = data.SamplesAsNumpy() if data.IntSamplesIsNone() else data.IntSamplesAsNumpy()
 
             # Check if the total size matches
             total_elements = samples_flat.size
@@ -50,7 +56,7 @@ def data_collection():
             
             if total_elements == expected_elements:
                 # Reshape the samples to a 2D array in channel-major order
-                samples_reshaped = samples_flat.reshape((num_channels, num_samples))
+                samples_reshaped = data.ChannelSamplesAsNumpy()
                 # Do something with the data
             else:
                 print(f"Error: Expected {expected_elements} elements but got {total_elements}.")